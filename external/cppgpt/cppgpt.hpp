@@ -2,8 +2,12 @@
 
 #include <chrono>
 #include <format>
+#include <functional>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <nlohmann/json.hpp>
@@ -12,6 +16,73 @@ using json = nlohmann::json;
 
 namespace ignacionr
 {
+    // Splits a text/event-stream into events as its chunks arrive and hands the data of
+    // each one (its "data:" lines joined by newlines) to the sink.
+    class sse_parser
+    {
+    public:
+        explicit sse_parser(std::function<void(std::string_view)> sink) : sink_{std::move(sink)} {}
+
+        void operator()(std::string_view chunk)
+        {
+            buffer_ += chunk;
+            size_t pos = 0;
+            for (auto eol = buffer_.find('\n'); eol != std::string::npos; eol = buffer_.find('\n', pos)) {
+                std::string_view line{buffer_.data() + pos, eol - pos};
+                pos = eol + 1;
+                if (line.ends_with('\r')) {
+                    line.remove_suffix(1);
+                }
+                if (line.empty()) {
+                    dispatch();
+                    continue;
+                }
+                if (line.starts_with(':')) {
+                    // a comment, servers send them to keep the connection alive
+                    continue;
+                }
+                auto const colon = line.find(':');
+                auto value = colon == std::string_view::npos ? std::string_view{} : line.substr(colon + 1);
+                if (value.starts_with(' ')) {
+                    value.remove_prefix(1);
+                }
+                // event, id and retry are of no use for completions
+                if (line.substr(0, colon) == "data") {
+                    if (has_data_) {
+                        data_ += '\n';
+                    }
+                    data_ += value;
+                    has_data_ = true;
+                }
+            }
+            buffer_.erase(0, pos);
+        }
+
+        // the stream may end without the blank line after its last event, or even its newline
+        void finish()
+        {
+            if (!buffer_.empty()) {
+                (*this)("\n");
+            }
+            dispatch();
+        }
+
+    private:
+        void dispatch()
+        {
+            if (has_data_) {
+                sink_(data_);
+            }
+            data_.clear();
+            has_data_ = false;
+        }
+
+        std::function<void(std::string_view)> sink_;
+        std::string buffer_;
+        std::string data_;
+        bool has_data_{false};
+    };
+
     class cppgpt
     {
     public:
@@ -62,6 +133,49 @@ namespace ignacionr
             return response;
         }
 
+        // Like sendMessage but with "stream": true, on_delta getting the reply as it is written.
+        // do_post_stream(url, body, header_client, chunk_sink) posts and feeds the response to
+        // chunk_sink as it arrives; when it stops early the partial reply is kept and returned.
+        std::string sendMessageStream(std::string_view message, auto do_post_stream, std::function<void(std::string_view)> on_delta, std::string_view role = "user", std::string_view model = "grok-2-latest", float temperature = 0.45)
+        {
+            wait_min_time();
+            conversation.push_back({{"role", role}, {"content", message}});
+
+            json payload = {
+                {"model", model},
+                {"messages", conversation},
+                {"temperature", temperature},
+                {"stream", true}};
+
+            std::string reply;
+            sse_parser events{[&reply, &on_delta](std::string_view data) {
+                if (data == "[DONE]") {
+                    return;
+                }
+                auto const chunk = json::parse(data);
+                if (!chunk.contains("choices") || chunk["choices"].empty()) {
+                    return;
+                }
+                auto const &delta = chunk["choices"][0]["delta"];
+                if (delta.contains("content") && delta["content"].is_string()) {
+                    auto const &text = delta["content"].get_ref<std::string const &>();
+                    reply += text;
+                    if (on_delta) on_delta(text);
+                }
+            }};
+            auto url = std::format("{}/chat/completions", base_url_);
+            auto body = payload.dump();
+            do_post_stream(url, body, [this](auto header_setter){
+                header_setter("Authorization: Bearer " + api_key_);
+                header_setter("Content-Type: application/json");
+                header_setter("Accept: text/event-stream");
+            }, [&events](std::string_view chunk) { events(chunk); });
+            events.finish();
+
+            conversation.push_back({{"role", "assistant"}, {"content", reply}});
+            return reply;
+        }
+
         void clear()
         {
             conversation.clear();
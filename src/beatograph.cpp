@@ -7,7 +7,9 @@
 #include <fstream>
 #include <filesystem>
 #include <iostream>
+#include <map>
 #include <ranges>
+#include <set>
 #include <string>
 #include <stdexcept>
 #include <unordered_map>
@@ -28,6 +30,7 @@
 #include "hosting/ssh/screen_all.hpp"
 #include "../external/cppgpt/cppgpt.hpp"
 #include "structural/views/assertion.hpp"
+#include "structural/views/view_executor.hpp"
 #include "git/host.hpp"
 #include "git/screen.hpp"
 #include "media/radio/host.hpp"
@@ -41,6 +44,7 @@
 #include "hosting/notify/host.hpp"
 #include "hosting/notify/screen.hpp"
 #include "structural/panel/config.hpp"
+#include "structural/panel/watcher.hpp"
 #include "cloud/cppgpt/screen.hpp"
 #include "cloud/cppgpt/command.hpp"
 #include "cloud/gtts/host.hpp"
@@ -100,13 +104,69 @@ void setup_fonts()
     io.Fonts->AddFontFromFileTTF("assets/fonts/Montserrat-Bold.ttf", iconFontSize, nullptr, io.Fonts->GetGlyphRangesCyrillic());
 }
 
-void load_panels(auto tabs, auto &loaded_panels, auto localhost, auto menu_tabs)
+struct loaded_panel_t
 {
-    // remove previously loaded panels
-    while (!loaded_panels.empty())
+    std::string title;
+    std::shared_ptr<panel::config> config;
+};
+using loaded_panels_t = std::map<std::filesystem::path, loaded_panel_t>;
+
+// Brings one panel file up to date: new files add a tab, deleted ones remove it, and
+// edited ones are diffed into their existing config so unchanged elements keep their
+// caches, mappings and hosts. A file that does not parse (e.g. half saved) is ignored.
+void sync_panel(std::filesystem::path const &path, auto tabs, loaded_panels_t &loaded_panels, auto localhost, auto menu_tabs)
+{
+    auto existing = loaded_panels.find(path);
+    if (!std::filesystem::exists(path))
+    {
+        if (existing != loaded_panels.end())
+        {
+            tabs->remove(existing->second.title);
+            loaded_panels.erase(existing);
+        }
+        return;
+    }
+    try
+    {
+        std::ifstream file{path};
+        nlohmann::json panel;
+        file >> panel;
+        auto const contents = panel.at("contents").get<nlohmann::json::array_t>();
+        auto const panel_name = panel.at("title").get<std::string>();
+        std::optional<views::refresh_policy> refresh_policy;
+        if (panel.contains("background-refresh"))
+        {
+            refresh_policy = views::refresh_policy::from_json(panel.at("background-refresh"));
+        }
+        if (existing != loaded_panels.end() && existing->second.title == panel_name)
+        {
+            auto const rebuilt = existing->second.config->update(contents, refresh_policy);
+            std::cerr << std::format("Panel {} reloaded, {} element(s) rebuilt", panel_name, rebuilt) << std::endl;
+            return;
+        }
+        auto config = std::make_shared<panel::config>(contents, localhost, refresh_policy);
+        if (existing != loaded_panels.end())
+        {
+            tabs->remove(existing->second.title);
+        }
+        loaded_panels[path] = {panel_name, config};
+        tabs->add({panel_name,
+                   [config]
+                   { config->render(); },
+                   menu_tabs});
+    }
+    catch (std::exception const &e)
+    {
+        std::cerr << std::format("Could not load panel {}: {}", path.string(), e.what()) << std::endl;
+    }
+}
+
+void load_panels(auto tabs, loaded_panels_t &loaded_panels, auto localhost, auto menu_tabs)
+{
+    std::set<std::filesystem::path> paths;
+    for (auto const &[path, panel] : loaded_panels)
     {
-        tabs->remove(loaded_panels.back());
-        loaded_panels.pop_back();
+        paths.insert(path);
     }
     std::filesystem::path panel_dir{"panels"};
     if (std::filesystem::exists(panel_dir) && std::filesystem::is_directory(panel_dir))
@@ -115,20 +175,14 @@ void load_panels(auto tabs, auto &loaded_panels, auto localhost, auto menu_tabs)
         {
             if (entry.is_regular_file() && entry.path().extension() == ".json")
             {
-                std::ifstream file{entry.path()};
-                nlohmann::json panel;
-                file >> panel;
-                auto config = std::make_shared<panel::config>(
-                    panel.at("contents").get<nlohmann::json::array_t>(), localhost);
-                auto const &panel_name = panel.at("title").get_ref<std::string const &>();
-                loaded_panels.push_back(panel_name);
-                tabs->add({panel_name,
-                           [config]
-                           { config->render(); },
-                           menu_tabs});
+                paths.insert(entry.path());
             }
         }
     }
+    for (auto const &path : paths)
+    {
+        sync_panel(path, tabs, loaded_panels, localhost, menu_tabs);
+    }
 }
 
 template <typename T>
@@ -249,6 +303,9 @@ int main()
         auto text_command_host = std::make_shared<structural::text_command::host>();
         registrar::add({}, text_command_host);
 
+        // tabs add their providers as they are created
+        registrar::add({}, std::make_shared<search::host>());
+
         text_command_host->add_source({
             [](std::string const &, std::function<void(std::string const &)> callback) {
             },
@@ -275,6 +332,7 @@ int main()
 
         auto summarize_fn = std::make_shared<std::function<std::string(std::string_view)>>(services::summarize{});
         registrar::add({}, summarize_fn);
+        registrar::add({}, std::make_shared<services::summarize::stream_t>(services::summarize{}));
 
         auto open_fn = std::make_shared<std::function<void(std::string const &)>> ([localhost](std::string const &command) {
             localhost->open_content(command);
@@ -337,7 +395,7 @@ int main()
 
         std::shared_ptr<screen_tabs> tabs;
 
-        std::vector<std::string> loaded_panels;
+        loaded_panels_t loaded_panels;
 
         std::vector<group_t> all_tabs;
         std::function<void(std::string_view)> menu_tabs;
@@ -420,6 +478,34 @@ int main()
             file >> all_tabs_json;
         }
 
+        // before any database gets opened
+        if (all_tabs_json.contains("sqlite"))
+        {
+            hosting::db::database::options() = hosting::db::database::options_t::from_json(all_tabs_json.at("sqlite"));
+        }
+        if (all_tabs_json.contains("ssh"))
+        {
+            localhost->session_pool().configure(hosting::local::ssh_sessions::options_t::from_json(all_tabs_json.at("ssh")));
+            localhost->ssh_batching().configure(hosting::local::ssh_batcher::options_t::from_json(all_tabs_json.at("ssh")));
+        }
+        if (all_tabs_json.contains("docker"))
+        {
+            docker::host::options() = docker::host::options_t::from_json(all_tabs_json.at("docker"));
+        }
+        if (all_tabs_json.contains("assertions"))
+        {
+            views::assertion_engine::instance().configure(views::assertion_engine::options_t::from_json(all_tabs_json.at("assertions")));
+        }
+        if (all_tabs_json.contains("feeds"))
+        {
+            media::rss::refresh_queue::options() = media::rss::refresh_queue::options_t::from_json(all_tabs_json.at("feeds"));
+            media::rss::host::options() = media::rss::host::options_t::from_json(all_tabs_json.at("feeds"));
+        }
+        if (all_tabs_json.contains("views"))
+        {
+            views::view_executor::instance().configure(views::view_executor::options_t::from_json(all_tabs_json.at("views")));
+        }
+
         std::unordered_map<std::string, std::shared_ptr<toggl::screen>> toggl_screens_by_id;
 
         auto quitting = std::make_shared<std::function<bool()>>([]{ return views::quitting(); });
@@ -531,6 +617,7 @@ int main()
 
         // enumerate the ./panels directory
         load_panels(tabs, loaded_panels, localhost, menu_tabs);
+        panel::watcher panel_watcher{"panels"};
 
         report::host report_host{localhost};
         std::jthread report_thread{[&report_host, &notify_host]
@@ -561,8 +648,11 @@ int main()
         screen->run(
             [&notify_host](std::string_view text)
             { notify_host(text, "Main"); },
-            [&tabs, &tools]
+            [&tabs, &tools, &panel_watcher, &loaded_panels, localhost, &menu_tabs]
             {
+            for (auto const &path : panel_watcher.poll()) {
+                sync_panel(path, tabs, loaded_panels, localhost, menu_tabs);
+            }
             if (ImGui::IsKeyDown(ImGuiMod_Ctrl)) {
                 // if (ImGui::IsKeyPressed(ImGuiKey_J)) {
                 //     tabs->select(jira_tab_name);
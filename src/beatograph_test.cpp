@@ -1,7 +1,12 @@
 #include <gtest/gtest.h>
 
 // Include the header file for the module being tested
+#include "../external/cppgpt/cppgpt.hpp"
+#include "cloud/docker/engine_api.hpp"
 #include "cloud/metrics/metrics_parser.hpp"
+#include "hosting/ssh_batch.hpp"
+#include "media/rss/feed.hpp"
+#include "media/rss/sqliterepo.hpp"
 
 TEST(metrics_parser_test, should_parse_help_line) {
   // Create an instance of the beatograph module
@@ -106,6 +111,143 @@ TEST(metrics_parser_test, should_handle_tags_with_spaces) {
   ASSERT_TRUE(parsed);
 }
 
+TEST(ssh_batcher_test, should_split_framed_output) {
+  auto const results = hosting::local::ssh_batcher::parse_output(
+    "hello\n\n__m__ 0 0\nno newline\n__m__ 1 0\n\n__m__ 2 3\n", "__m__", 3);
+  ASSERT_EQ(results.size(), 3);
+  ASSERT_EQ(results[0].output, "hello\n");
+  ASSERT_EQ(results[0].exit_code, 0);
+  ASSERT_EQ(results[1].output, "no newline");
+  ASSERT_EQ(results[2].output, "");
+  ASSERT_EQ(results[2].exit_code, 3);
+}
+
+TEST(ssh_batcher_test, should_stop_at_truncated_output) {
+  auto const results = hosting::local::ssh_batcher::parse_output(
+    "first\n\n__m__ 0 0\nsecond, cut short", "__m__", 2);
+  ASSERT_EQ(results.size(), 1);
+  ASSERT_EQ(results[0].output, "first\n");
+}
+
+TEST(ssh_batcher_test, should_quote_single_quotes) {
+  ASSERT_EQ(hosting::local::ssh_batcher::quote("echo 'hi'"), "'echo '\\''hi'\\'''");
+}
+
+namespace {
+  docker::http_reader reader_over(std::string const &data, size_t &pos) {
+    // hands out a few bytes at a time, like a slow socket
+    return docker::http_reader{[&data, &pos](char *buffer, size_t size) -> int {
+      if (pos >= data.size()) return -1;
+      auto const count = std::min<size_t>({size, 3, data.size() - pos});
+      data.copy(buffer, count, pos);
+      pos += count;
+      return static_cast<int>(count);
+    }};
+  }
+}
+
+TEST(http_reader_test, should_join_chunks) {
+  std::string const data {"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n4\r\n[{\"a\r\n5;ext=1\r\n\":1}]\r\n0\r\n\r\n"};
+  size_t pos {0};
+  auto reader {reader_over(data, pos)};
+  auto const response = reader.read_response();
+  ASSERT_EQ(response.status, 200);
+  ASSERT_EQ(response.body, "[{\"a\":1}]");
+  ASSERT_EQ(pos, data.size());
+}
+
+TEST(http_reader_test, should_keep_alive_across_responses) {
+  std::string const data {"HTTP/1.1 404 Not Found\r\nContent-Length: 2\r\n\r\n{}HTTP/1.1 204 No Content\r\n\r\n"};
+  size_t pos {0};
+  auto reader {reader_over(data, pos)};
+  auto const first = reader.read_response();
+  ASSERT_EQ(first.status, 404);
+  ASSERT_EQ(first.body, "{}");
+  ASSERT_TRUE(first.keep_alive);
+  auto const second = reader.read_response();
+  ASSERT_EQ(second.status, 204);
+  ASSERT_EQ(second.body, "");
+}
+
+TEST(xml_stream_test, should_not_depend_on_chunk_boundaries) {
+  std::string const xml {"<?xml version=\"1.0\"?><a x='1 &amp; 2'><!-- <b> --><b>x &lt; y</b><![CDATA[<raw>]]><c/></a>"};
+  for (size_t step : {1, 2, 5, 1000}) {
+    std::string events;
+    media::rss::xml_stream stream{{
+      [&events](std::string_view name, auto const &attributes) {
+        events += std::format("<{}{}>", name, media::rss::xml_stream::attribute(attributes, "x"));
+      },
+      [&events](std::string_view name) { events += std::format("</{}>", name); },
+      [&events](std::string_view text) { events += text; }
+    }};
+    for (size_t pos = 0; pos < xml.size(); pos += step) {
+      stream(std::string_view{xml}.substr(pos, step));
+    }
+    ASSERT_EQ(events, "<a1 & 2><b>x < y</b><raw><c></c></a>");
+  }
+}
+
+TEST(feed_reader_test, should_stop_at_known_items) {
+  std::string const rss {
+    "<rss><channel><title>Pod</title>"
+    "<item><title>New</title><link>n</link></item>"
+    "<item><title>Old 1</title><link>o1</link></item>"
+    "<item><title>Old 2</title><link>o2</link></item>"
+    "<item><title>Old 3</title><link>o3</link></item>"
+    "<item><title>Old 4</title><link>o4</link></item>"
+    "</channel></rss>"};
+  media::rss::feed target{{}};
+  media::rss::feed::items_t items;
+  media::rss::feed_reader reader{target, items, [](media::rss::feed::item const &item) { return item.link.starts_with('o'); }};
+  reader(rss);
+  ASSERT_TRUE(reader.stopped());
+  ASSERT_EQ(target.feed_title, "Pod");
+  ASSERT_EQ(items.size(), 1);
+  ASSERT_EQ(items[0].title, "New");
+}
+
+TEST(feed_test, should_merge_new_items_in_order) {
+  auto const make_item = [](std::string link, int seconds, std::string guid = {}) {
+    media::rss::feed::item item;
+    item.link = std::move(link);
+    item.guid = std::move(guid);
+    item.updated = std::chrono::system_clock::time_point{std::chrono::seconds{seconds}};
+    return item;
+  };
+  media::rss::feed target{{}};
+  target.merge_items({make_item("c", 30), make_item("a", 10)});
+  auto const before = target.items();
+  auto const fresh = target.merge_items({make_item("d", 40, "g"), make_item("a", 10), make_item("b", 20), make_item("e", 50, "g")});
+  ASSERT_EQ(fresh.size(), 2);
+  auto const &items = *target.items();
+  ASSERT_EQ(items.size(), 4);
+  ASSERT_EQ(items[0].link, "d");
+  ASSERT_EQ(items[1].link, "c");
+  ASSERT_EQ(items[2].link, "b");
+  ASSERT_EQ(items[3].link, "a");
+  // a reader holding the previous list still sees it unchanged
+  ASSERT_EQ(before->size(), 2);
+}
+
+TEST(sqliterepo_test, should_quote_search_words_as_prefixes) {
+  ASSERT_EQ(media::rss::sqliterepo::match_expression("  rust async\t"), "\"rust\"* \"async\"*");
+  ASSERT_EQ(media::rss::sqliterepo::match_expression("say \"hi\" OR("), "\"say\"* \"\"\"hi\"\"\"* \"OR(\"*");
+  ASSERT_EQ(media::rss::sqliterepo::match_expression(" "), "");
+}
+
+TEST(sse_parser_test, should_split_events_across_chunks) {
+  std::string const stream {": keep-alive\r\ndata: a\r\ndata: b\r\n\r\nevent: x\ndata:c\n\ndata: [DONE]"};
+  for (size_t step = 1; step <= stream.size(); ++step) {
+    std::vector<std::string> events;
+    ignacionr::sse_parser parser{[&events](std::string_view data) { events.emplace_back(data); }};
+    for (size_t pos = 0; pos < stream.size(); pos += step) {
+      parser(std::string_view{stream}.substr(pos, step));
+    }
+    parser.finish();
+    ASSERT_EQ(events, (std::vector<std::string>{"a\nb", "c", "[DONE]"}));
+  }
+}
+
 // Entry point for running the tests
 int main(int argc, char** argv) {
   // Initialize the testing framework
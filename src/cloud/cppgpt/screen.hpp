@@ -2,7 +2,10 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <stop_token>
 #include <string>
+#include <thread>
 
 #include <imgui.h>
 #include "../../../external/cppgpt/cppgpt.hpp"
@@ -10,25 +13,17 @@
 
 namespace cppgpt {
     struct screen {
-        void render(std::shared_ptr<ignacionr::cppgpt> gpt, std::function<void(std::string_view)> say) noexcept 
+        void render(std::shared_ptr<ignacionr::cppgpt> gpt, std::function<void(std::string_view)> say) noexcept
         {
+            if (reply_) {
+                render_reply(say);
+                return;
+            }
             if (prompt.reserve(2500); ImGui::InputTextMultiline("##prompt", prompt.data(), prompt.capacity())) {
                 prompt = prompt.data();
             }
-            std::string result;
             if (ImGui::SmallButton("Run") || ImGui::IsKeyChordPressed(ImGuiKey_Enter | ImGuiMod_Ctrl)) {
-                try {
-                    result = gpt->sendMessage(prompt, 
-                    [](auto a, auto b, auto c){
-                        http::fetch fetch;
-                        return fetch.post(a, b, c);
-                    },
-                    "user", "grok-2-latest")["choices"][0]["message"]["content"];
-                }
-                catch(std::exception &e) {
-                    result = e.what();
-                }
-                say(result);
+                ask(gpt, prompt);
                 prompt.clear();
             }
             else {
@@ -45,11 +40,68 @@ namespace cppgpt {
             if (ImGui::SmallButton("Clear")) {
                 gpt->clear();
             }
-            if (!result.empty()) {
-                ImGui::TextWrapped("%s", result.c_str());
-            }
         }
     private:
+        // the reply being streamed in, shared with the thread receiving it
+        struct reply_t {
+            std::string question;
+            std::mutex mutex;
+            std::string text;
+            bool done{false};
+        };
+
+        void ask(std::shared_ptr<ignacionr::cppgpt> gpt, std::string question) {
+            auto reply = std::make_shared<reply_t>();
+            reply->question = question;
+            reply_ = reply;
+            // the conversation belongs to this thread until done is set
+            worker_ = std::jthread{[gpt, reply, question](std::stop_token stop) {
+                try {
+                    gpt->sendMessageStream(question,
+                        [&stop](auto const &url, auto const &body, auto headers, auto sink) {
+                            http::fetch{240}.post_stream(url, body, headers, sink, stop);
+                        },
+                        [&reply](std::string_view delta) {
+                            std::lock_guard lock{reply->mutex};
+                            reply->text += delta;
+                        },
+                        "user", "grok-2-latest");
+                }
+                catch (std::exception &e) {
+                    std::lock_guard lock{reply->mutex};
+                    reply->text = e.what();
+                }
+                std::lock_guard lock{reply->mutex};
+                reply->done = true;
+            }};
+        }
+
+        void render_reply(std::function<void(std::string_view)> const &say) {
+            std::string text;
+            bool done;
+            {
+                std::lock_guard lock{reply_->mutex};
+                text = reply_->text;
+                done = reply_->done;
+            }
+            ImGui::TextWrapped("You: %s", reply_->question.c_str());
+            ImGui::TextWrapped("AI: %s", text.c_str());
+            if (done) {
+                bool const stopped {worker_.get_stop_token().stop_requested()};
+                worker_.join();
+                reply_.reset();
+                if (!stopped) {
+                    say(text);
+                }
+            }
+            else if (ImGui::SmallButton("Stop")) {
+                worker_.request_stop();
+            }
+        }
+
         std::string prompt;
+        std::shared_ptr<reply_t> reply_;
+        // last, so it is stopped and joined before the rest goes
+        std::jthread worker_;
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <format>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "../../hosting/ssh_execute.hpp"
+
+namespace docker {
+    struct http_response {
+        int status{};
+        std::map<std::string, std::string> headers; // names in lower case
+        std::string body;
+        bool keep_alive{true};
+    };
+
+    // an error answered by the engine itself, as opposed to a broken connection
+    struct engine_error : std::runtime_error {
+        engine_error(int status, std::string const &message) : std::runtime_error{message}, status{status} {}
+        int status;
+    };
+
+    // Reads HTTP/1.1 responses the way the engine sends them (Content-Length or chunked
+    // bodies) from a byte source. The source returns the bytes read, 0 when nothing
+    // arrived in time, or a negative value once the connection is closed.
+    struct http_reader {
+        using source_t = std::function<int(char *, size_t)>;
+
+        explicit http_reader(source_t source) : source_{std::move(source)} {}
+
+        http_response read_response() {
+            auto response {read_head()};
+            if (response.status == 204 || response.status == 304 || response.status / 100 == 1) {
+                return response;
+            }
+            if (chunked(response)) {
+                std::string chunk;
+                while (read_chunk(chunk)) {
+                    response.body += chunk;
+                }
+            }
+            else if (auto const it = response.headers.find("content-length"); it != response.headers.end()) {
+                response.body = read_exact(std::stoull(it->second));
+            }
+            else {
+                // no framing: the body runs until the server closes
+                while (fill(true)) {}
+                response.body = buffer_.substr(pos_);
+                pos_ = buffer_.size();
+                response.keep_alive = false;
+            }
+            return response;
+        }
+
+        // status line and headers; the body is left for read_chunk or read_response
+        http_response read_head() {
+            http_response response;
+            auto const status_line {read_line()};
+            // HTTP/1.1 200 OK
+            auto const space = status_line.find(' ');
+            if (!status_line.starts_with("HTTP/") || space == std::string::npos) {
+                throw std::runtime_error(std::format("Unexpected response from the docker engine: {}", status_line));
+            }
+            response.status = std::stoi(status_line.substr(space + 1, 3));
+            for (auto line {read_line()}; !line.empty(); line = read_line()) {
+                auto const colon = line.find(':');
+                if (colon == std::string::npos) {
+                    continue;
+                }
+                auto name {line.substr(0, colon)};
+                std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+                auto const value_start = line.find_first_not_of(" \t", colon + 1);
+                response.headers[name] = value_start == std::string::npos ? std::string{} : line.substr(value_start);
+            }
+            if (auto const it = response.headers.find("connection"); it != response.headers.end() && it->second == "close") {
+                response.keep_alive = false;
+            }
+            return response;
+        }
+
+        static bool chunked(http_response const &response) {
+            auto const it = response.headers.find("transfer-encoding");
+            return it != response.headers.end() && it->second.find("chunked") != std::string::npos;
+        }
+
+        // the next piece of a chunked body; false after the last one
+        bool read_chunk(std::string &chunk) {
+            auto const size_line {read_line()};
+            auto const size {std::stoull(size_line.substr(0, size_line.find(';')), nullptr, 16)};
+            if (size == 0) {
+                // trailers end with an empty line
+                while (!read_line().empty()) {}
+                chunk.clear();
+                return false;
+            }
+            chunk = read_exact(size);
+            if (!read_line().empty()) {
+                throw std::runtime_error("Malformed chunk from the docker engine");
+            }
+            return true;
+        }
+
+    private:
+        std::string read_line() {
+            for (;;) {
+                if (auto const end = buffer_.find("\r\n", pos_); end != std::string::npos) {
+                    auto line {buffer_.substr(pos_, end - pos_)};
+                    pos_ = end + 2;
+                    return line;
+                }
+                fill(false);
+            }
+        }
+
+        std::string read_exact(size_t size) {
+            while (buffer_.size() - pos_ < size) {
+                fill(false);
+            }
+            auto result {buffer_.substr(pos_, size)};
+            pos_ += size;
+            return result;
+        }
+
+        // appends what the source has; false at the end of an unframed body
+        bool fill(bool until_close) {
+            if (pos_ > 0 && pos_ == buffer_.size()) {
+                buffer_.clear();
+                pos_ = 0;
+            }
+            char chunk[16384];
+            auto const nbytes = source_(chunk, sizeof(chunk));
+            if (nbytes > 0) {
+                buffer_.append(chunk, static_cast<size_t>(nbytes));
+                return true;
+            }
+            if (nbytes < 0 && until_close) {
+                return false;
+            }
+            throw std::runtime_error(nbytes < 0 ? "The docker engine closed the connection" : "Timed out waiting for the docker engine");
+        }
+
+        source_t source_;
+        std::string buffer_;
+        size_t pos_{0};
+    };
+
+    // Docker Engine API client over an ssh stream-local forward of the engine socket. One
+    // keep-alive connection serves every request to a host, one at a time. Its channel
+    // counts against the host's max-channels like commands do.
+    struct engine_api {
+        using session_factory_t = std::function<std::shared_ptr<ssh_execute>()>;
+        using chunk_sink_t = std::function<bool(std::string_view)>;
+
+        engine_api(session_factory_t session_factory, std::string socket_path = "/var/run/docker.sock", int timeout_ms = 10000)
+            : session_factory_{std::move(session_factory)}, socket_path_{std::move(socket_path)}, timeout_ms_{timeout_ms} {}
+
+        // GET target and parse the JSON answer; engine errors come back as exceptions
+        nlohmann::json get(std::string const &target) {
+            auto const response {request(target)};
+            if (response.status >= 400) {
+                std::string message {response.body};
+                try {
+                    message = nlohmann::json::parse(response.body).at("message").get<std::string>();
+                }
+                catch (...) {}
+                throw engine_error{response.status, std::format("Docker engine error {} on {}: {}", response.status, target, message)};
+            }
+            return nlohmann::json::parse(response.body);
+        }
+
+        // GET target on a connection of its own and hand the chunked body to sink as it
+        // arrives, until the engine ends it, sink returns false or stopped() turns true;
+        // opened is called once the engine accepted the request. Streams like events stay
+        // open for good, so they get a dedicated channel outside the host's limit.
+        void stream(std::string const &target, std::function<void()> const &opened, chunk_sink_t const &sink, std::function<bool()> const &stopped) {
+            auto const session {session_factory_()};
+            auto const tunnel {session->open_unix_tunnel(socket_path_, ssh_execute::channel_kind::dedicated)};
+            http_reader reader{[&tunnel, &stopped, this](char *buffer, size_t size) {
+                for (;;) {
+                    auto const nbytes = tunnel->read(buffer, size, timeout_ms_);
+                    if (nbytes != 0) return nbytes;
+                    // a quiet stream is not an error, only a reason to check for cancellation
+                    if (stopped()) return -1;
+                }
+            }};
+            if (!tunnel->write(std::format("GET {} HTTP/1.1\r\nHost: docker\r\nUser-Agent: beatograph\r\n\r\n", target))) {
+                throw std::runtime_error("Could not write to the docker engine socket");
+            }
+            try {
+                auto const response {reader.read_head()};
+                if (response.status >= 400) {
+                    throw engine_error{response.status, std::format("Docker engine error {} on {}", response.status, target)};
+                }
+                if (!http_reader::chunked(response)) {
+                    throw std::runtime_error(std::format("Expected a chunked stream from {}", target));
+                }
+                opened();
+                std::string chunk;
+                while (reader.read_chunk(chunk) && sink(chunk)) {}
+            }
+            catch (...) {
+                if (!stopped()) {
+                    throw;
+                }
+            }
+        }
+
+        // containers in the shape of `docker ps -a --format json`, e.g. filters
+        // {"status": ["running"], "name": ["web"]} are applied by the engine
+        nlohmann::json containers(nlohmann::json const &filters = nlohmann::json::object()) {
+            auto target {std::string{"/containers/json?all=1"}};
+            if (!filters.empty()) {
+                target += "&filters=" + url_encode(filters.dump());
+            }
+            nlohmann::json result = nlohmann::json::array();
+            for (auto const &container : get(target)) {
+                result.push_back(to_cli_row(container));
+            }
+            return result;
+        }
+
+        // the equivalent of `docker exec <container> ps aux`, without running anything in it
+        std::string top(std::string const &container) {
+            auto const answer {get(std::format("/containers/{}/top?ps_args=aux", url_encode(container)))};
+            std::string result;
+            auto const append_row = [&result](nlohmann::json const &row) {
+                for (auto const &cell : row) {
+                    result += cell.get<std::string>();
+                    result += ' ';
+                }
+                if (!result.empty()) result.back() = '\n';
+            };
+            append_row(answer.at("Titles"));
+            for (auto const &process : answer.at("Processes")) {
+                append_row(process);
+            }
+            return result;
+        }
+
+        static std::string url_encode(std::string_view text) {
+            std::string result;
+            for (unsigned char c : text) {
+                if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+                    result += static_cast<char>(c);
+                }
+                else {
+                    result += std::format("%{:02X}", static_cast<unsigned int>(c));
+                }
+            }
+            return result;
+        }
+
+        // maps an engine container object to the string fields the CLI prints
+        static nlohmann::json to_cli_row(nlohmann::json const &container) {
+            auto const join = [](auto const &items, std::string_view separator) {
+                std::string result;
+                for (auto const &item : items) {
+                    if (!result.empty()) result += separator;
+                    result += item;
+                }
+                return result;
+            };
+            std::vector<std::string> names;
+            for (auto const &name : container.value("Names", nlohmann::json::array())) {
+                auto text {name.get<std::string>()};
+                names.push_back(text.starts_with('/') ? text.substr(1) : text);
+            }
+            std::vector<std::string> ports;
+            for (auto const &port : container.value("Ports", nlohmann::json::array())) {
+                auto const target {std::format("{}/{}", port.value("PrivatePort", 0), port.value("Type", std::string{"tcp"}))};
+                if (port.contains("PublicPort")) {
+                    ports.push_back(std::format("{}:{}->{}", port.value("IP", std::string{}), port.at("PublicPort").get<int>(), target));
+                }
+                else {
+                    ports.push_back(target);
+                }
+            }
+            std::vector<std::string> labels;
+            for (auto const &[key, value] : container.value("Labels", nlohmann::json::object()).items()) {
+                labels.push_back(std::format("{}={}", key, value.template get<std::string>()));
+            }
+            std::vector<std::string> mounts;
+            int local_volumes {0};
+            for (auto const &mount : container.value("Mounts", nlohmann::json::array())) {
+                auto const type {mount.value("Type", std::string{})};
+                if (type == "volume") {
+                    ++local_volumes;
+                }
+                mounts.push_back(mount.value(type == "volume" ? "Name" : "Source", std::string{}));
+            }
+            std::vector<std::string> networks;
+            if (container.contains("NetworkSettings") && container.at("NetworkSettings").contains("Networks")) {
+                for (auto const &[name, network] : container.at("NetworkSettings").at("Networks").items()) {
+                    networks.push_back(name);
+                }
+            }
+            std::chrono::sys_seconds const created {std::chrono::seconds{container.value("Created", 0LL)}};
+            auto const id {container.value("Id", std::string{})};
+            return {
+                {"ID", id.substr(0, 12)},
+                {"Names", join(names, ",")},
+                {"Image", container.value("Image", std::string{})},
+                {"Command", std::format("\"{}\"", container.value("Command", std::string{}))},
+                {"CreatedAt", std::format("{:%Y-%m-%d %H:%M:%S} +0000 UTC", created)},
+                {"RunningFor", running_for(std::chrono::system_clock::now() - created)},
+                {"Ports", join(ports, ", ")},
+                {"Labels", join(labels, ",")},
+                {"Mounts", join(mounts, ",")},
+                {"LocalVolumes", std::to_string(local_volumes)},
+                {"Networks", join(networks, ",")},
+                {"State", container.value("State", std::string{})},
+                {"Status", container.value("Status", std::string{})},
+            };
+        }
+
+        static std::string running_for(std::chrono::system_clock::duration age) {
+            using namespace std::chrono;
+            auto const seconds {duration_cast<std::chrono::seconds>(age).count()};
+            if (seconds < 60) return std::format("{} seconds ago", seconds);
+            if (seconds < 2 * 60) return "About a minute ago";
+            if (seconds < 60 * 60) return std::format("{} minutes ago", seconds / 60);
+            if (seconds < 2 * 60 * 60) return "About an hour ago";
+            if (seconds < 2 * 24 * 60 * 60) return std::format("{} hours ago", seconds / (60 * 60));
+            if (seconds < 14 * 24 * 60 * 60) return std::format("{} days ago", seconds / (24 * 60 * 60));
+            if (seconds < 60 * 24 * 60 * 60) return std::format("{} weeks ago", seconds / (7 * 24 * 60 * 60));
+            if (seconds < 365 * 24 * 60 * 60) return std::format("{} months ago", seconds / (30 * 24 * 60 * 60));
+            return std::format("{} years ago", seconds / (365 * 24 * 60 * 60));
+        }
+
+    private:
+        http_response request(std::string const &target) {
+            std::lock_guard lock{mutex_};
+            for (int attempt = 0;; ++attempt) {
+                // a kept-alive connection may have been dropped while idle; retry those once
+                bool const reused {tunnel_ != nullptr};
+                try {
+                    if (!tunnel_) {
+                        connect();
+                    }
+                    if (!tunnel_->write(std::format("GET {} HTTP/1.1\r\nHost: docker\r\nUser-Agent: beatograph\r\n\r\n", target))) {
+                        throw std::runtime_error("Could not write to the docker engine socket");
+                    }
+                    auto response {reader_->read_response()};
+                    if (!response.keep_alive) {
+                        disconnect();
+                    }
+                    return response;
+                }
+                catch (...) {
+                    disconnect();
+                    if (!reused || attempt > 0) {
+                        throw;
+                    }
+                }
+            }
+        }
+
+        void connect() {
+            session_ = session_factory_();
+            tunnel_ = session_->open_unix_tunnel(socket_path_);
+            reader_ = std::make_unique<http_reader>([this](char *buffer, size_t size) {
+                return tunnel_->read(buffer, size, timeout_ms_);
+            });
+        }
+
+        void disconnect() {
+            reader_.reset();
+            tunnel_.reset();
+            session_.reset();
+        }
+
+        session_factory_t session_factory_;
+        std::string socket_path_;
+        int timeout_ms_;
+        std::mutex mutex_;
+        std::shared_ptr<ssh_execute> session_;
+        std::unique_ptr<ssh_execute::tunnel_t> tunnel_;
+        std::unique_ptr<http_reader> reader_;
+    };
+}
@@ -1,13 +1,75 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <format>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
 #include <nlohmann/json.hpp>
 
 #include "../../hosting/host_local.hpp"
+#include "engine_api.hpp"
+#include "snapshot.hpp"
 namespace docker {
 struct host {
+    using processes_t = std::unordered_map<std::string, std::string>;
+
+    struct options_t {
+        // how old a snapshot may be when answering assertions and screens
+        std::chrono::seconds max_age{15};
+        // talk to the engine socket instead of parsing the CLI, when the ssh user may
+        bool engine_api{true};
+        std::string socket{"/var/run/docker.sock"};
+        // how long to stay on the CLI after the engine socket failed
+        std::chrono::seconds engine_retry{300};
+        // follow docker events to keep the snapshot current between fetches
+        bool events{true};
+        // while following events, how often the whole list is fetched anyway
+        std::chrono::seconds events_resync{300};
+
+        // reads the "docker" section of beatograph.json, e.g.
+        // {"max-age-seconds": 15, "engine-api": true, "socket": "/var/run/docker.sock"}
+        static options_t from_json(nlohmann::json const &node) {
+            options_t result;
+            if (node.contains("max-age-seconds")) {
+                result.max_age = std::chrono::seconds{node.at("max-age-seconds").get<int>()};
+            }
+            if (node.contains("engine-api")) {
+                result.engine_api = node.at("engine-api").get<bool>();
+            }
+            if (node.contains("socket")) {
+                result.socket = node.at("socket").get<std::string>();
+            }
+            if (node.contains("engine-retry-seconds")) {
+                result.engine_retry = std::chrono::seconds{node.at("engine-retry-seconds").get<int>()};
+            }
+            if (node.contains("events")) {
+                result.events = node.at("events").get<bool>();
+            }
+            if (node.contains("events-resync-seconds")) {
+                result.events_resync = std::chrono::seconds{node.at("events-resync-seconds").get<int>()};
+            }
+            return result;
+        }
+    };
+
+    static options_t &options() {
+        static options_t options;
+        return options;
+    }
+
     host(std::string const &host_name) : host_name_{host_name} {}
 
+    host(host const &) = delete;
+
+    ~host() {
+        events_->stop = true;
+    }
+
     std::string execute_command(std::string_view command, std::shared_ptr<hosting::local::host> localhost, bool sudo = true) const {
         return localhost->ssh(std::format("{} {}", sudo ? "sudo" : "", command), host_name_);
     }
@@ -18,28 +80,143 @@ struct host {
         return localhost->ssh(cmd, host_name_);
     }
 
+    void stream_command(std::string_view command, std::string_view container_id, std::shared_ptr<::hosting::local::host> localhost, ssh_execute::chunk_sink_t sink, bool sudo = true) const {
+        auto cmd = std::format("docker exec {} {} {}", container_id, sudo ? "sudo" : "", command);
+        cmd = localhost->resolve_environment(cmd);
+        localhost->ssh_stream(cmd, host_name_, std::move(sink));
+    }
+
+    // forces a new docker ps, e.g. from a refresh button
     void fetch_ps(std::shared_ptr<::hosting::local::host> localhost) {
-        auto result = execute_command("docker ps -a --format json", localhost);
-        // the result is not a json, but a succession of json lines
-        // we need to add the missing commas to make it a valid json array
-        std::string json_array = "[";
-        for (auto &c : result) {
-            if (c == '\n') {
-                json_array += ",";
+        docker_ps_->invalidate();
+        ps(localhost);
+    }
+
+    // the containers as of at most max_age ago (longer while events keep them current);
+    // concurrent callers share one docker ps
+    std::shared_ptr<nlohmann::json const> ps(std::shared_ptr<::hosting::local::host> localhost) {
+        watch_events(localhost);
+        return docker_ps_->get(ps_max_age(), [this, localhost] { return query_ps(localhost); });
+    }
+
+    // Refreshes a stale snapshot in the background, for screens that must not block. After a
+    // failed fetch the next attempt waits max_age, doubling with each further failure up to
+    // five minutes, so a host that is down is not reconnected to every frame.
+    void refresh_ps_async(std::shared_ptr<::hosting::local::host> localhost) {
+        watch_events(localhost);
+        auto const now {std::chrono::steady_clock::now()};
+        if (now - docker_ps_->fetched_at() <= ps_max_age() || now < ps_retry_at_.load() || refreshing_.exchange(true)) {
+            return;
+        }
+        std::thread([this, localhost] {
+            bool fetched {true};
+            try {
+                ps(localhost);
+            }
+            catch (std::exception const &e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                fetched = false;
+            }
+            ps_failures_ = fetched ? 0 : std::min(ps_failures_ + 1, 10u);
+            auto const backoff {fetched ? std::chrono::seconds{0} :
+                std::min<std::chrono::seconds>(std::max(ps_max_age(), std::chrono::seconds{1}) * (1 << (ps_failures_ - 1)), std::chrono::minutes{5})};
+            ps_retry_at_ = std::chrono::steady_clock::now() + backoff;
+            refreshing_ = false;
+        }).detach();
+    }
+
+    nlohmann::json query_ps(std::shared_ptr<::hosting::local::host> localhost) const {
+        return containers(nlohmann::json::object(), localhost);
+    }
+
+    // containers matching filters like {"status": ["running"], "name": ["web"]}, filtered
+    // by the engine; rows have the fields of `docker ps --format json`
+    nlohmann::json containers(nlohmann::json const &filters, std::shared_ptr<::hosting::local::host> localhost) const {
+        if (auto api = engine(localhost)) {
+            try {
+                return api->containers(filters);
             }
-            else {
-                json_array += c;
+            catch (std::exception const &e) {
+                engine_failed(e);
             }
         }
-        // remove the last comma
-        if (json_array.size() > 1) json_array.pop_back();
-        json_array += "]";
-        
-        docker_ps_.store(std::make_shared<nlohmann::json>(nlohmann::json::parse(json_array)));
+        std::string command {"docker ps -a --format json"};
+        for (auto const &[key, values] : filters.items()) {
+            for (auto const &value : values) {
+                command += std::format(" --filter {}", hosting::local::ssh_batcher::quote(std::format("{}={}", key, value.template get<std::string>())));
+            }
+        }
+        // one json object per line
+        auto const output {execute_command(command, localhost)};
+        nlohmann::json result = nlohmann::json::array();
+        for (size_t start = 0; start < output.size();) {
+            auto end = output.find('\n', start);
+            if (end == std::string::npos) {
+                end = output.size();
+            }
+            if (output.find_first_not_of(" \t\r", start) < end) {
+                result.push_back(nlohmann::json::parse(output.substr(start, end - start)));
+            }
+            start = end + 1;
+        }
+        return result;
+    }
+
+    // Applies one docker event to a container list; false when the list cannot be
+    // patched (e.g. a container it has never seen) and must be fetched again.
+    static bool apply_event(nlohmann::json &containers, nlohmann::json const &event) {
+        if (event.value("Type", std::string{}) != "container" || !event.contains("Actor")) {
+            return true;
+        }
+        auto const action {event.value("Action", std::string{})};
+        auto const &actor {event.at("Actor")};
+        auto const id {actor.value("ID", std::string{})};
+        auto const attributes {actor.value("Attributes", nlohmann::json::object())};
+        auto const row = std::find_if(containers.begin(), containers.end(), [&id](auto const &container) {
+            auto const short_id {container.value("ID", std::string{})};
+            return !short_id.empty() && id.starts_with(short_id);
+        });
+        if (action == "destroy") {
+            if (row != containers.end()) {
+                containers.erase(row);
+            }
+            return true;
+        }
+        static std::set<std::string, std::less<>> const changes_state {"create", "start", "restart", "die", "pause", "unpause", "rename"};
+        if (!changes_state.contains(action)) {
+            // exec_*, health_status, attach, kill (a die follows) and the like
+            return true;
+        }
+        if (row == containers.end() || action == "create") {
+            return false;
+        }
+        auto &container {*row};
+        if (action == "start" || action == "restart" || action == "unpause") {
+            container["State"] = "running";
+            container["Status"] = "Up Less than a second";
+        }
+        else if (action == "die") {
+            container["State"] = "exited";
+            container["Status"] = std::format("Exited ({}) Less than a second ago", attributes.value("exitCode", std::string{"0"}));
+        }
+        else if (action == "pause") {
+            container["State"] = "paused";
+            container["Status"] = "Up (Paused)";
+        }
+        else if (action == "rename") {
+            auto name {attributes.value("name", std::string{})};
+            container["Names"] = name.starts_with('/') ? name.substr(1) : name;
+        }
+        return true;
     }
 
-    std::shared_ptr<nlohmann::json> ps() const {
-        return docker_ps_.load();
+    // whether docker events are being followed for this host right now
+    bool events_live() const {
+        return events_->live;
+    }
+
+    std::shared_ptr<nlohmann::json const> ps() const {
+        return docker_ps_->latest();
     }
 
     void open_shell(std::string const &container_id, std::shared_ptr<::hosting::local::host> localhost) const {
@@ -79,6 +256,10 @@ struct host {
         return execute_command(std::format("docker logs {}", container_id), localhost);
     }
 
+    void stream_logs(std::string const &container_id, std::shared_ptr<::hosting::local::host> localhost, ssh_execute::chunk_sink_t sink) const {
+        localhost->ssh_stream(std::format("sudo docker logs {} 2>&1", container_id), host_name_, std::move(sink));
+    }
+
     std::string all_processes(std::string const &container_id, std::shared_ptr<::hosting::local::host> localhost) const {
         return execute_command(std::format("docker exec {} ps aux", container_id), localhost);
     }
@@ -88,19 +269,25 @@ struct host {
         execute_command(cmd, localhost);
     }
 
+    // Answered from the full list while events keep it current or it is still fresh; otherwise
+    // from a shared snapshot of the running containers only, filtered by the engine.
     bool is_container_running(std::string const &container_id_or_name, std::shared_ptr<::hosting::local::host> localhost) {
-        auto ps = this->ps();
-        if (!ps) {
-            fetch_ps(localhost);
-            ps = this->ps();
-            if (!ps) {
-                throw std::runtime_error("Error: could not fetch ps");
-            }
+        watch_events(localhost);
+        auto all {docker_ps_->latest()};
+        if (all && (events_live() || std::chrono::steady_clock::now() - docker_ps_->fetched_at() <= ps_max_age())) {
+            return running_in(*all, container_id_or_name);
         }
-        if (!ps->is_array()) {
-            throw std::runtime_error(std::format("Error: expected array, got {}", ps->dump()));
+        auto const running {running_ps_->get(ps_max_age(), [this, localhost] {
+            return containers({{"status", {"running"}}}, localhost);
+        })};
+        return running_in(*running, container_id_or_name);
+    }
+
+    static bool running_in(nlohmann::json const &ps, std::string const &container_id_or_name) {
+        if (!ps.is_array()) {
+            throw std::runtime_error(std::format("Error: expected array, got {}", ps.dump()));
         }
-        auto const &array {ps->get<nlohmann::json::array_t>()};
+        auto const &array {ps.get_ref<nlohmann::json::array_t const &>()};
         return std::any_of(array.begin(), array.end(), [&container_id_or_name](auto const &container) {
             bool found{false};
             if (container.contains("Names")) {
@@ -124,12 +311,208 @@ struct host {
         });
     }
 
-    bool is_process_running(std::string const &container_id, std::string const &process_name, std::shared_ptr<::hosting::local::host> localhost) const {
-        auto processes = all_processes(container_id, localhost);
-        return processes.find(process_name) != std::string::npos;
+    bool is_process_running(std::string const &container_id, std::string const &process_name, std::shared_ptr<::hosting::local::host> localhost) {
+        auto const processes = processes_snapshot(container_id, localhost);
+        auto const it = processes->find(container_id);
+        return it != processes->end() && it->second.find(process_name) != std::string::npos;
     }
+
+    // The ps aux output of every container anybody asked about, fetched together in one
+    // remote exec per refresh; a container seen for the first time joins the next fetch.
+    std::shared_ptr<processes_t const> processes_snapshot(std::string const &container_id, std::shared_ptr<::hosting::local::host> localhost) {
+        {
+            std::lock_guard lock{watched_mutex_};
+            watched_containers_.insert(container_id);
+        }
+        return processes_->get(options().max_age,
+            [this, localhost] { return query_processes(localhost); },
+            [&container_id](processes_t const &processes) { return processes.contains(container_id); });
+    }
+
 private:
+    static constexpr std::string_view process_marker{"__beatograph_docker_ps__"};
+
+    // shared with the events thread, which may outlive this host
+    struct events_t {
+        std::atomic<bool> started{false};
+        std::atomic<bool> live{false};
+        std::atomic<bool> stop{false};
+    };
+
+    std::chrono::seconds ps_max_age() const {
+        return events_->live ? options().events_resync : options().max_age;
+    }
+
+    // Starts following container events on this host, through the engine API when it is
+    // reachable and `docker events` otherwise, reconnecting with a growing delay.
+    void watch_events(std::shared_ptr<::hosting::local::host> localhost) {
+        if (!options().events || events_->started.exchange(true)) {
+            return;
+        }
+        std::thread([events = events_, docker_ps = docker_ps_, processes = processes_, host_name = host_name_, localhost] {
+            std::string pending;
+            auto const opened = [&] {
+                // whatever happened while we were not listening is only in a full fetch
+                pending.clear();
+                docker_ps->invalidate();
+                events->live = true;
+            };
+            auto const sink = [&](std::string_view chunk) {
+                pending += chunk;
+                for (auto end = pending.find('\n'); end != std::string::npos; end = pending.find('\n')) {
+                    auto const line {pending.substr(0, end)};
+                    pending.erase(0, end + 1);
+                    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                        continue;
+                    }
+                    auto const event {nlohmann::json::parse(line, nullptr, false)};
+                    if (event.is_discarded()) {
+                        // skip it, but the list may have missed a change
+                        std::cerr << std::format("Ignoring malformed docker event from {}: {}", host_name, line) << std::endl;
+                        docker_ps->invalidate();
+                        continue;
+                    }
+                    if (auto const current = docker_ps->latest()) {
+                        auto patched {*current};
+                        if (apply_event(patched, event)) {
+                            docker_ps->set(std::move(patched));
+                        }
+                        else {
+                            docker_ps->invalidate();
+                        }
+                    }
+                    auto const action {event.value("Action", std::string{})};
+                    if (action == "start" || action == "die") {
+                        processes->invalidate();
+                    }
+                }
+                return !events->stop;
+            };
+            std::chrono::seconds backoff{1};
+            while (!events->stop) {
+                auto const started {std::chrono::steady_clock::now()};
+                try {
+                    std::string const filters {R"({"type":["container"]})"};
+                    if (options().engine_api) {
+                        engine_api api{[localhost, host_name] { return localhost->session_pool().get(host_name); }, options().socket};
+                        try {
+                            api.stream(std::format("/events?filters={}", engine_api::url_encode(filters)), opened, sink,
+                                [&events] { return events->stop.load(); });
+                        }
+                        catch (engine_error const &) {
+                            throw;
+                        }
+                        catch (std::exception const &e) {
+                            std::cerr << std::format("Docker engine events unavailable on {}, using the CLI: {}", host_name, e.what()) << std::endl;
+                            opened();
+                            localhost->ssh_stream("sudo docker events --format '{{json .}}' --filter type=container", host_name, sink, 5,
+                                ssh_execute::channel_kind::dedicated);
+                        }
+                    }
+                    else {
+                        opened();
+                        localhost->ssh_stream("sudo docker events --format '{{json .}}' --filter type=container", host_name, sink, 5,
+                                ssh_execute::channel_kind::dedicated);
+                    }
+                }
+                catch (std::exception const &e) {
+                    std::cerr << std::format("Docker events on {} stopped: {}", host_name, e.what()) << std::endl;
+                }
+                events->live = false;
+                if (std::chrono::steady_clock::now() - started > std::chrono::minutes{1}) {
+                    backoff = std::chrono::seconds{1};
+                }
+                for (auto waited = std::chrono::seconds{0}; waited < backoff && !events->stop; ++waited) {
+                    std::this_thread::sleep_for(std::chrono::seconds{1});
+                }
+                backoff = std::min<std::chrono::seconds>(backoff * 2, std::chrono::seconds{60});
+            }
+        }).detach();
+    }
+
+    processes_t query_processes(std::shared_ptr<::hosting::local::host> localhost) const {
+        std::set<std::string> watched;
+        {
+            std::lock_guard lock{watched_mutex_};
+            watched = watched_containers_;
+        }
+        if (auto api = engine(localhost)) {
+            try {
+                processes_t result;
+                for (auto const &container : watched) {
+                    try {
+                        result[container] = api->top(container);
+                    }
+                    catch (engine_error const &) {
+                        // stopped or missing: no processes, like docker exec failing
+                        result[container];
+                    }
+                }
+                return result;
+            }
+            catch (std::exception const &e) {
+                engine_failed(e);
+            }
+        }
+        std::string script;
+        for (auto const &container : watched) {
+            auto const quoted {hosting::local::ssh_batcher::quote(container)};
+            script += std::format("printf '\\n%s %s\\n' '{}' {}; docker exec {} ps aux 2>/dev/null\n", process_marker, quoted, quoted);
+        }
+        auto const output {execute_command(std::format("sh -c {}", hosting::local::ssh_batcher::quote(script)), localhost)};
+        processes_t result;
+        std::string const separator {std::format("\n{} ", process_marker)};
+        for (auto pos = output.find(separator); pos != std::string::npos;) {
+            auto const name_start = pos + separator.size();
+            auto const name_end = output.find('\n', name_start);
+            if (name_end == std::string::npos) {
+                break;
+            }
+            auto const next = output.find(separator, name_end);
+            result[output.substr(name_start, name_end - name_start)] =
+                output.substr(name_end + 1, next == std::string::npos ? std::string::npos : next - name_end - 1);
+            pos = next;
+        }
+        return result;
+    }
+
+    // the engine client, or nothing while it is disabled or recently failed
+    engine_api *engine(std::shared_ptr<::hosting::local::host> localhost) const {
+        if (!options().engine_api) {
+            return nullptr;
+        }
+        std::lock_guard lock{engine_mutex_};
+        if (std::chrono::steady_clock::now() < engine_retry_at_) {
+            return nullptr;
+        }
+        if (!engine_) {
+            engine_ = std::make_unique<engine_api>([localhost, host_name = host_name_] {
+                return localhost->session_pool().get(host_name);
+            }, options().socket);
+        }
+        return engine_.get();
+    }
+
+    void engine_failed(std::exception const &e) const {
+        std::cerr << std::format("Docker engine API unavailable on {}, using the CLI: {}", host_name_, e.what()) << std::endl;
+        std::lock_guard lock{engine_mutex_};
+        engine_retry_at_ = std::chrono::steady_clock::now() + options().engine_retry;
+    }
+
     std::string host_name_;
-    std::atomic<std::shared_ptr<nlohmann::json>> docker_ps_;
+    mutable std::mutex engine_mutex_;
+    mutable std::unique_ptr<engine_api> engine_;
+    mutable std::chrono::steady_clock::time_point engine_retry_at_;
+    std::shared_ptr<snapshot<nlohmann::json>> docker_ps_{std::make_shared<snapshot<nlohmann::json>>()};
+    // only the running containers, for assertions when docker_ps_ is stale
+    std::shared_ptr<snapshot<nlohmann::json>> running_ps_{std::make_shared<snapshot<nlohmann::json>>()};
+    std::shared_ptr<snapshot<processes_t>> processes_{std::make_shared<snapshot<processes_t>>()};
+    std::shared_ptr<events_t> events_{std::make_shared<events_t>()};
+    std::atomic<bool> refreshing_{false};
+    // owned by the refresh thread while refreshing_ is set
+    unsigned int ps_failures_{0};
+    std::atomic<std::chrono::steady_clock::time_point> ps_retry_at_{};
+    mutable std::mutex watched_mutex_;
+    std::set<std::string> watched_containers_;
 };
 }
\ No newline at end of file
@@ -1,11 +1,13 @@
 #pragma once
 
+#include <format>
 #include <functional>
 #include <ranges>
 #include <imgui.h>
 #include "host.hpp"
 #include "../../hosting/host.hpp"
 #include "../../hosting/host_local.hpp"
+#include "../../structural/views/streamed_view.hpp"
 
 #pragma execution_character_set(push, "utf-8")
 
@@ -18,6 +20,11 @@ struct docker_screen
         if (ImGui::CollapsingHeader("Containers"))
         {
             auto &host{getter()};
+            host.refresh_ps_async(localhost);
+            if (host.events_live())
+            {
+                ImGui::TextDisabled("Following docker events");
+            }
             auto const &ps = host.ps();
             if (ps)
             {
@@ -42,7 +49,6 @@ struct docker_screen
                         "LocalVolumes",
                         "Mounts",
                         "RunningFor",
-                        "Size",
                         "State"
                     };
                     if (ImGui::BeginTable("Docker Containers",
@@ -86,6 +92,11 @@ struct docker_screen
                             {
                                 host.open_logs(container_id);
                             }
+                            ImGui::SameLine();
+                            if (ImGui::Button(ICON_MD_ARTICLE))
+                            {
+                                logs_container_ = container_id;
+                            }
 
                             for (auto const &column_name : cols)
                             {
@@ -109,6 +120,21 @@ struct docker_screen
             {
                 ImGui::Text("N/A");
             }
+            if (!logs_container_.empty())
+            {
+                if (ImGui::SmallButton(ICON_MD_CLOSE))
+                {
+                    logs_container_.clear();
+                }
+                else
+                {
+                    ImGui::SameLine();
+                    views::streamed_view(std::format("Logs {}", logs_container_),
+                        [&host, localhost, container_id = logs_container_](views::chunk_sink_t const &sink) {
+                            host.stream_logs(container_id, localhost, sink);
+                        });
+                }
+            }
             if (ImGui::SmallButton(ICON_MD_REFRESH))
             {
                 auto t = std::thread([localhost, &host]
@@ -125,4 +151,5 @@ struct docker_screen
     }
 
     bool only_running{true};
+    std::string logs_container_;
 };
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+
+namespace docker {
+    // The latest value of something fetched from a host. Readers that find it missing or
+    // older than their freshness bound share a single fetch instead of each running one.
+    template<typename T>
+    struct snapshot {
+        using ptr = std::shared_ptr<T const>;
+        using fetcher_t = std::function<T()>;
+        using accept_t = std::function<bool(T const &)>;
+
+        ptr latest() const {
+            std::lock_guard lock{mutex_};
+            return value_;
+        }
+
+        std::chrono::steady_clock::time_point fetched_at() const {
+            std::lock_guard lock{mutex_};
+            return fetched_;
+        }
+
+        // Returns a value no older than max_age that satisfies accept (when given),
+        // fetching it if needed; a fetch already in flight is joined rather than repeated.
+        ptr get(std::chrono::steady_clock::duration max_age, fetcher_t const &fetcher, accept_t const &accept = {}) {
+            // a fetch that started before our requirements were known may not satisfy them
+            for (int attempt = 0;; ++attempt) {
+                std::shared_future<ptr> pending;
+                std::shared_ptr<std::promise<ptr>> promise;
+                {
+                    std::lock_guard lock{mutex_};
+                    if (value_ && std::chrono::steady_clock::now() - fetched_ <= max_age && (!accept || accept(*value_))) {
+                        return value_;
+                    }
+                    if (!pending_.valid()) {
+                        promise = std::make_shared<std::promise<ptr>>();
+                        pending_ = promise->get_future().share();
+                    }
+                    pending = pending_;
+                }
+                if (promise) {
+                    fetch(fetcher, *promise);
+                }
+                auto result {pending.get()};
+                if (!accept || accept(*result) || attempt > 0) {
+                    return result;
+                }
+            }
+        }
+
+        // replaces the value, e.g. after applying an incremental change
+        void set(T value) {
+            auto updated {std::make_shared<T const>(std::move(value))};
+            std::lock_guard lock{mutex_};
+            value_ = updated;
+            fetched_ = std::chrono::steady_clock::now();
+        }
+
+        // the next get() fetches again, readers keep seeing the current value meanwhile
+        void invalidate() {
+            std::lock_guard lock{mutex_};
+            fetched_ = {};
+        }
+
+    private:
+        void fetch(fetcher_t const &fetcher, std::promise<ptr> &promise) {
+            try {
+                auto fetched {std::make_shared<T const>(fetcher())};
+                {
+                    std::lock_guard lock{mutex_};
+                    value_ = fetched;
+                    fetched_ = std::chrono::steady_clock::now();
+                    pending_ = {};
+                }
+                promise.set_value(fetched);
+            }
+            catch (...) {
+                {
+                    std::lock_guard lock{mutex_};
+                    pending_ = {};
+                }
+                promise.set_exception(std::current_exception());
+            }
+        }
+
+        mutable std::mutex mutex_;
+        ptr value_;
+        std::chrono::steady_clock::time_point fetched_;
+        std::shared_future<ptr> pending_;
+    };
+}
@@ -15,7 +15,7 @@ namespace cloud::whatsapp
         void render(host &h, auto &img_cache) noexcept {
             if (try_connect_) {
                 try {
-                    long long const texture_id {img_cache.load_texture_from_url(h.get_qr_image_url(), {}, ".png", std::chrono::minutes{1})};
+                    long long const texture_id {img_cache.load_texture_from_url(h.get_qr_image_url(), {}, std::chrono::minutes{1})};
                     ImGui::Image(reinterpret_cast<ImTextureID>(texture_id), ImVec2{345.0f, 345.0f});
                 }
                 catch(const std::exception &e) {
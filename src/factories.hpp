@@ -25,6 +25,9 @@
 #include "cloud/deel/host.hpp"
 #include "cloud/deel/screen.hpp"
 
+#include "structural/search/host.hpp"
+#include "structural/search/screen.hpp"
+
 
 struct screen_factories {
     static std::map<std::string, std::function<group_t(nlohmann::json::object_t const &)>> map(auto &menu_tabs, auto &menu_tabs_and, auto &notify_host, auto &radio_host, auto &localhost, auto &cache, auto &gpt, auto &toggl_screens_by_id, auto &ssh_all, auto &mappings)
@@ -141,6 +144,18 @@ struct screen_factories {
          {
              auto podcast_host = std::make_shared<media::rss::host>([localhost](std::string_view command) -> std::string
                                                              { return localhost->execute_command(command); });
+             registrar::get<search::host>({})->add_provider([podcast_host, &radio_host](std::string_view query, search::match_sink_t sink)
+             {
+                 for (auto const &hit : podcast_host->search(query))
+                 {
+                     sink({std::format("{} {}: {}##{}", hit.enclosure.empty() ? ICON_MD_ARTICLE : ICON_MD_PODCASTS, hit.feed_title, hit.title, hit.link),
+                           [&radio_host, hit]
+                           {
+                               if (hit.enclosure.empty()) "open"_sfn(hit.link);
+                               else radio_host.play(hit.enclosure);
+                           }});
+                 }
+             }, [] {});
              return group_t{names::radio_tab_name, [rss_screen = std::make_shared<media::rss::screen>(podcast_host, [&radio_host](std::string_view url)
                                                                                         { radio_host.play(std::string{url}); }, [localhost](std::string_view text)
                                                                                         { return localhost->execute_command(text, false); }),
@@ -150,6 +165,14 @@ struct screen_factories {
                         rss_screen->render(); },
                             menu_tabs, ImVec4(0.05f, 0.5f, 0.05f, 1.0f)};
          }},
+         {"search", [&menu_tabs](nlohmann::json::object_t const &) {
+             auto screen = std::make_shared<search::screen>(*registrar::get<search::host>({}));
+             return group_t{ICON_MD_SEARCH " Search",
+                            [screen] {
+                                screen->render();
+                            },
+                            menu_tabs};
+         }},
          {"whatsapp", [&mappings, &cache, &menu_tabs](nlohmann::json::object_t const &) {
              auto host = std::make_shared<cloud::whatsapp::host>(mappings.at("whatsapp"));
              registrar::add({}, host);
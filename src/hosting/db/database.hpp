@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <format>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "sqlite.hpp"
+
+namespace hosting::db
+{
+    // One SQLite file in WAL mode. Writes are queued to a single writer thread, which runs
+    // every batch waiting at the time in one transaction, each batch in its own savepoint so
+    // a failing one does not take the others down. Reads borrow one of a few read-only
+    // connections and, thanks to WAL, never wait for a write in progress.
+    struct database
+    {
+        struct options_t {
+            bool wal{true};
+            std::string synchronous{"NORMAL"};
+            long long mmap_size{256ll << 20};
+            long long cache_size{16ll << 20};
+            unsigned int readers{4};
+            int busy_timeout_ms{5000};
+
+            // reads the "sqlite" section of beatograph.json, e.g.
+            // {"wal": true, "synchronous": "NORMAL", "mmap-mb": 256, "cache-mb": 16, "readers": 4, "busy-timeout-ms": 5000}
+            static options_t from_json(nlohmann::json const &node) {
+                options_t result;
+                if (node.contains("wal")) {
+                    result.wal = node.at("wal").get<bool>();
+                }
+                if (node.contains("synchronous")) {
+                    result.synchronous = node.at("synchronous").get<std::string>();
+                }
+                if (node.contains("mmap-mb")) {
+                    result.mmap_size = node.at("mmap-mb").get<long long>() << 20;
+                }
+                if (node.contains("cache-mb")) {
+                    result.cache_size = node.at("cache-mb").get<long long>() << 20;
+                }
+                if (node.contains("readers")) {
+                    result.readers = std::max(1u, node.at("readers").get<unsigned int>());
+                }
+                if (node.contains("busy-timeout-ms")) {
+                    result.busy_timeout_ms = node.at("busy-timeout-ms").get<int>();
+                }
+                return result;
+            }
+        };
+
+        static options_t &options() {
+            static options_t options;
+            return options;
+        }
+
+        explicit database(std::string path) : path_{std::move(path)}, writer_{path_}
+        {
+            configure(writer_);
+            if (options().wal) {
+                writer_.exec("PRAGMA journal_mode=WAL");
+            }
+            writer_thread_ = std::jthread{[this](std::stop_token stop) { write_loop(stop); }};
+        }
+
+        database(database const &) = delete;
+
+        // Queues batch(sqlite &) to the writer; the future carries its result, or the
+        // exception that rolled it back.
+        template <typename F>
+        auto write(F batch) -> std::future<std::invoke_result_t<F &, sqlite &>>
+        {
+            using result_t = std::invoke_result_t<F &, sqlite &>;
+            auto promise = std::make_shared<std::promise<result_t>>();
+            auto future = promise->get_future();
+            enqueue([promise, batch = std::move(batch)](sqlite &db) mutable -> completion_t {
+                try {
+                    sqlite::transaction savepoint{db};
+                    if constexpr (std::is_void_v<result_t>) {
+                        batch(db);
+                        savepoint.commit();
+                        return [promise](std::exception_ptr error) {
+                            if (error) promise->set_exception(error);
+                            else promise->set_value();
+                        };
+                    }
+                    else {
+                        auto result = std::make_shared<result_t>(batch(db));
+                        savepoint.commit();
+                        return [promise, result](std::exception_ptr error) {
+                            if (error) promise->set_exception(error);
+                            else promise->set_value(std::move(*result));
+                        };
+                    }
+                }
+                catch (...) {
+                    return [promise, error = std::current_exception()](std::exception_ptr) {
+                        promise->set_exception(error);
+                    };
+                }
+            });
+            return future;
+        }
+
+        // a write nobody waits for; failures are logged
+        template <typename F>
+        void post(F batch)
+        {
+            write([batch = std::move(batch), path = path_](sqlite &db) mutable {
+                try {
+                    batch(db);
+                }
+                catch (std::exception const &e) {
+                    std::cerr << std::format("Write to {} failed: {}", path, e.what()) << std::endl;
+                    throw;
+                }
+            });
+        }
+
+        // Runs reader(sqlite &) on a read-only connection, waiting for one when all are
+        // taken. Don't nest reads: with a single reader configured that waits forever.
+        template <typename F>
+        auto read(F &&reader) -> std::invoke_result_t<F &, sqlite &>
+        {
+            lease connection{*this};
+            return reader(*connection.db_);
+        }
+
+    private:
+        using completion_t = std::function<void(std::exception_ptr)>;
+        using job_t = std::function<completion_t(sqlite &)>;
+
+        struct lease
+        {
+            lease(database &owner) : owner_{owner}
+            {
+                {
+                    std::unique_lock lock{owner_.readers_mutex_};
+                    owner_.readers_cv_.wait(lock, [this] {
+                        return !owner_.idle_readers_.empty() || owner_.open_readers_ < options().readers;
+                    });
+                    if (!owner_.idle_readers_.empty()) {
+                        db_ = std::move(owner_.idle_readers_.back());
+                        owner_.idle_readers_.pop_back();
+                        return;
+                    }
+                    ++owner_.open_readers_;
+                }
+                try {
+                    db_ = std::make_unique<sqlite>(owner_.path_, SQLITE_OPEN_READONLY);
+                    owner_.configure(*db_);
+                }
+                catch (...) {
+                    db_.reset();
+                    release();
+                    throw;
+                }
+            }
+
+            lease(lease const &) = delete;
+
+            ~lease() { release(); }
+
+            void release()
+            {
+                {
+                    std::lock_guard lock{owner_.readers_mutex_};
+                    if (db_) {
+                        owner_.idle_readers_.push_back(std::move(db_));
+                    }
+                    else {
+                        --owner_.open_readers_;
+                    }
+                }
+                owner_.readers_cv_.notify_one();
+            }
+
+            database &owner_;
+            std::unique_ptr<sqlite> db_;
+        };
+
+        void configure(sqlite &db)
+        {
+            auto const &opts = options();
+            db.exec(std::format("PRAGMA busy_timeout={}", opts.busy_timeout_ms));
+            db.exec(std::format("PRAGMA synchronous={}", opts.synchronous));
+            db.exec(std::format("PRAGMA mmap_size={}", opts.mmap_size));
+            // a negative cache_size is in KiB rather than pages
+            db.exec(std::format("PRAGMA cache_size=-{}", opts.cache_size >> 10));
+        }
+
+        void enqueue(job_t job)
+        {
+            {
+                std::lock_guard lock{queue_mutex_};
+                queue_.push_back(std::move(job));
+            }
+            queue_cv_.notify_one();
+        }
+
+        void write_loop(std::stop_token stop)
+        {
+            for (;;) {
+                std::deque<job_t> jobs;
+                {
+                    std::unique_lock lock{queue_mutex_};
+                    queue_cv_.wait(lock, stop, [this] { return !queue_.empty(); });
+                    if (queue_.empty()) {
+                        return;
+                    }
+                    jobs.swap(queue_);
+                }
+                std::vector<completion_t> completions;
+                std::exception_ptr error;
+                try {
+                    sqlite::transaction transaction{writer_};
+                    for (auto &job : jobs) {
+                        completions.push_back(job(writer_));
+                    }
+                    transaction.commit();
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+                for (auto &completion : completions) {
+                    completion(error);
+                }
+                // the batch transaction could not even begin: run the rest one by one
+                for (auto pos = completions.size(); pos < jobs.size(); ++pos) {
+                    jobs[pos](writer_)(nullptr);
+                }
+            }
+        }
+
+        std::string path_;
+        sqlite writer_;
+        std::mutex queue_mutex_;
+        std::condition_variable_any queue_cv_;
+        std::deque<job_t> queue_;
+        std::mutex readers_mutex_;
+        std::condition_variable readers_cv_;
+        std::vector<std::unique_ptr<sqlite>> idle_readers_;
+        unsigned int open_readers_{0};
+        // last, so it is stopped and joined first; the writer drains the queue before leaving
+        std::jthread writer_thread_;
+    };
+}
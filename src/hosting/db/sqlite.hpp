@@ -1,9 +1,18 @@
 #pragma once
 
+#include <cstdint>
 #include <format>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 
 #include <sqlite3.h>
 
@@ -11,6 +20,187 @@ namespace hosting::db
 {
     struct sqlite
     {
+        using stmt_callback_t = std::function<void(sqlite3_stmt *)>;
+
+        // A prepared statement, kept to be bound and run many times.
+        struct statement
+        {
+            statement(sqlite3 *db, std::string const &sql) : db_{db}
+            {
+                if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt_, nullptr) != SQLITE_OK) {
+                    throw std::runtime_error(std::format("Failed to prepare statement: {}", sqlite3_errmsg(db_)));
+                }
+            }
+
+            statement(statement &&other) noexcept : db_{other.db_}, stmt_{std::exchange(other.stmt_, nullptr)} {}
+            statement(statement const &) = delete;
+
+            ~statement()
+            {
+                if (stmt_) sqlite3_finalize(stmt_);
+            }
+
+            // runs the statement with args, handing every row to callback; the arguments
+            // outlive the run, so text is bound without copying it
+            template <typename... Args>
+            void run(stmt_callback_t const &callback, Args const &...args)
+            {
+                for_each_row([&callback](sqlite3_stmt *stmt) { if (callback) callback(stmt); }, args...);
+            }
+
+            template <typename Sink, typename... Args>
+            void for_each_row(Sink &&sink, Args const &...args)
+            {
+                in_use guard{*this};
+                bind(SQLITE_STATIC, args...);
+                int rc;
+                while ((rc = sqlite3_step(stmt_)) == SQLITE_ROW) {
+                    sink(stmt_);
+                }
+                if (rc != SQLITE_DONE) {
+                    throw std::runtime_error(std::format("SQL error: {}", sqlite3_errmsg(db_)));
+                }
+            }
+
+            // binds args from the first placeholder on; destructor is SQLITE_STATIC or SQLITE_TRANSIENT
+            template <typename... Args>
+            void bind(sqlite3_destructor_type destructor, Args const &...args)
+            {
+                int index = 1;
+                (bind_param(stmt_, index++, args, destructor), ...);
+            }
+
+            bool busy() const { return busy_; }
+            sqlite3_stmt *get() const { return stmt_; }
+            sqlite3 *db() const { return db_; }
+
+            // marks the statement taken and leaves it reset, with no dangling bindings
+            struct in_use
+            {
+                in_use(statement &owner) : owner_{owner} { owner_.busy_ = true; }
+                ~in_use()
+                {
+                    sqlite3_reset(owner_.stmt_);
+                    sqlite3_clear_bindings(owner_.stmt_);
+                    owner_.busy_ = false;
+                }
+                statement &owner_;
+            };
+
+        private:
+            sqlite3 *db_;
+            sqlite3_stmt *stmt_{nullptr};
+            bool busy_{false};
+        };
+
+        // Rows of a query decoded into tuples, e.g.
+        //   for (auto const &[id, url] : db.query<long long, std::string>("SELECT id, url FROM feed")) ...
+        // Columns may be integral, floating point, std::string, std::string_view (valid until
+        // the next row) or std::optional of those for nullable columns.
+        template <typename... Columns>
+        struct rows
+        {
+            using row_t = std::tuple<Columns...>;
+
+            struct sentinel {};
+
+            struct iterator
+            {
+                using value_type = row_t;
+                using difference_type = std::ptrdiff_t;
+
+                row_t const &operator*() const { return row_; }
+                iterator &operator++() { owner_->step(row_, done_); return *this; }
+                void operator++(int) { ++*this; }
+                bool operator==(sentinel) const { return done_; }
+
+                rows *owner_;
+                row_t row_;
+                bool done_{false};
+            };
+
+            // the arguments may be temporaries that die before the loop does, so they are copied
+            template <typename... Args>
+            rows(std::shared_ptr<statement> stmt, Args const &...args) : stmt_{std::move(stmt)}, guard_{*stmt_}
+            {
+                stmt_->bind(SQLITE_TRANSIENT, args...);
+            }
+            rows(rows const &) = delete;
+
+            iterator begin()
+            {
+                iterator it{this, {}};
+                step(it.row_, it.done_);
+                return it;
+            }
+            sentinel end() const { return {}; }
+
+        private:
+            void step(row_t &row, bool &done)
+            {
+                auto const rc = sqlite3_step(stmt_->get());
+                if (rc == SQLITE_ROW) {
+                    row = read_row(std::index_sequence_for<Columns...>{});
+                }
+                else if (rc == SQLITE_DONE) {
+                    done = true;
+                }
+                else {
+                    throw std::runtime_error(std::format("SQL error: {}", sqlite3_errmsg(stmt_->db())));
+                }
+            }
+
+            template <size_t... I>
+            row_t read_row(std::index_sequence<I...>) const
+            {
+                return row_t{read_column<Columns>(stmt_->get(), static_cast<int>(I))...};
+            }
+
+            std::shared_ptr<statement> stmt_;
+            statement::in_use guard_;
+        };
+
+        // Begins a transaction, or a savepoint when one is already open, and rolls it back
+        // unless commit() is reached; nests like the scopes that use it.
+        struct transaction
+        {
+            transaction(sqlite &db) : db_{db}
+            {
+                if (sqlite3_get_autocommit(db_.db_)) {
+                    db_.exec("BEGIN IMMEDIATE");
+                }
+                else {
+                    savepoint_ = std::format("sp_{}", ++db_.savepoints_);
+                    db_.exec(std::format("SAVEPOINT {}", savepoint_));
+                }
+            }
+
+            transaction(transaction const &) = delete;
+
+            ~transaction()
+            {
+                if (done_) return;
+                // never throw from here, we may be unwinding already
+                if (savepoint_.empty()) {
+                    sqlite3_exec(db_.db_, "ROLLBACK", nullptr, nullptr, nullptr);
+                }
+                else {
+                    sqlite3_exec(db_.db_, std::format("ROLLBACK TO {0}; RELEASE {0}", savepoint_).c_str(), nullptr, nullptr, nullptr);
+                }
+            }
+
+            void commit()
+            {
+                db_.exec(savepoint_.empty() ? std::string{"COMMIT"} : std::format("RELEASE {}", savepoint_));
+                done_ = true;
+            }
+
+        private:
+            sqlite &db_;
+            std::string savepoint_;
+            bool done_{false};
+        };
+
         sqlite(const std::string &path)
         {
             if (sqlite3_open(path.c_str(), &db_) != SQLITE_OK)
@@ -20,6 +210,19 @@ namespace hosting::db
             }
         }
 
+        // opens with explicit flags, e.g. SQLITE_OPEN_READONLY for a reader connection
+        sqlite(const std::string &path, int flags)
+        {
+            if (sqlite3_open_v2(path.c_str(), &db_, flags, nullptr) != SQLITE_OK)
+            {
+                std::string const message {db_ ? sqlite3_errmsg(db_) : "out of memory"};
+                close();
+                throw std::runtime_error(std::format("Can't open database: {} - {}", message, path));
+            }
+        }
+
+        sqlite(sqlite const &) = delete;
+
         ~sqlite() {
             close();
         }
@@ -48,6 +251,8 @@ namespace hosting::db
 
         void close()
         {
+            // statements must be finalized before the connection goes
+            statements_.clear();
             if (db_)
             {
                 sqlite3_close(db_);
@@ -63,36 +268,86 @@ namespace hosting::db
             }
         }
 
-        using stmt_callback_t = std::function<void(sqlite3_stmt *)>;
-
         // a variadic version of exec with callback
         template <typename... Args>
         void exec(const std::string &sql, stmt_callback_t callback, Args... args) {
-            sqlite3_stmt *stmt;
-            if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-                throw std::runtime_error(std::format("Failed to prepare statement: {}", sqlite3_errmsg(db_)));
-            }
+            cached(sql)->run(callback, args...);
+        }
 
-            int index = 1;
-            (bind_param(stmt, index++, args), ...);
+        // the rows of a query as tuples of Columns
+        template <typename... Columns, typename... Args>
+        rows<Columns...> query(const std::string &sql, Args const &...args) {
+            return rows<Columns...>{cached(sql), args...};
+        }
 
-            while (sqlite3_step(stmt) == SQLITE_ROW && callback) {
-                callback(stmt);
-            }
+        // the first column of the first row, if any
+        template <typename T, typename... Args>
+        std::optional<T> query_value(const std::string &sql, Args const &...args) {
+            std::optional<T> result;
+            cached(sql)->for_each_row([&result](sqlite3_stmt *stmt) {
+                if (!result) result = read_column<T>(stmt, 0);
+            }, args...);
+            return result;
+        }
 
-            if (sqlite3_finalize(stmt) != SQLITE_OK) {
-                throw std::runtime_error(std::format("SQL error: {}", sqlite3_errmsg(db_)));
-            }
+        // a statement owned by the caller, outside of the cache
+        statement prepare(std::string const &sql) {
+            return statement{db_, sql};
         }
 
         long long last_insert_rowid() const {
             return sqlite3_last_insert_rowid(db_);
         }
-        
+
     private:
+        // Prepared statements by SQL text. A statement still being stepped (a query inside
+        // the loop of the same query) is not shared, the nested use gets its own.
+        std::shared_ptr<statement> cached(std::string const &sql) {
+            auto &stmt = statements_[sql];
+            if (!stmt) {
+                stmt = std::make_shared<statement>(db_, sql);
+            }
+            if (stmt->busy()) {
+                return std::make_shared<statement>(db_, sql);
+            }
+            return stmt;
+        }
+
         template <typename T>
-        void bind_param(sqlite3_stmt *stmt, int index, T value) {
-            if constexpr (std::is_integral_v<T>) {
+        struct is_optional : std::false_type {};
+        template <typename T>
+        struct is_optional<std::optional<T>> : std::true_type {};
+
+        template <typename T>
+        static T read_column(sqlite3_stmt *stmt, int column) {
+            if constexpr (is_optional<T>::value) {
+                if (sqlite3_column_type(stmt, column) == SQLITE_NULL) {
+                    return std::nullopt;
+                }
+                return read_column<typename T::value_type>(stmt, column);
+            } else if constexpr (std::is_integral_v<T>) {
+                return static_cast<T>(sqlite3_column_int64(stmt, column));
+            } else if constexpr (std::is_floating_point_v<T>) {
+                return static_cast<T>(sqlite3_column_double(stmt, column));
+            } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+                auto const text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, column));
+                return text ? T{text, static_cast<size_t>(sqlite3_column_bytes(stmt, column))} : T{};
+            } else {
+                static_assert(always_false<T>::value, "Unsupported column type");
+            }
+        }
+
+        template <typename T>
+        static void bind_param(sqlite3_stmt *stmt, int index, T const &value, sqlite3_destructor_type destructor = SQLITE_TRANSIENT) {
+            if constexpr (is_optional<T>::value) {
+                if (value) {
+                    bind_param(stmt, index, *value, destructor);
+                } else {
+                    sqlite3_bind_null(stmt, index);
+                }
+            } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                sqlite3_bind_null(stmt, index);
+            } else if constexpr (std::is_integral_v<T>) {
                 if constexpr (sizeof(T) <= sizeof(int)) {
                     sqlite3_bind_int(stmt, index, value);
                 } else {
@@ -100,10 +355,10 @@ namespace hosting::db
                 }
             } else if constexpr (std::is_floating_point_v<T>) {
                 sqlite3_bind_double(stmt, index, value);
-            } else if constexpr (std::is_same_v<T, std::string>) {
-                sqlite3_bind_text(stmt, index, value.data(), value.size(), SQLITE_TRANSIENT);
-            } else if constexpr (std::is_same_v<T, std::string_view>) {
-                sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+            } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+                sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()), destructor);
+            } else if constexpr (std::is_convertible_v<T, const char *>) {
+                sqlite3_bind_text(stmt, index, value, -1, destructor);
             } else {
                 static_assert(always_false<T>::value, "Unsupported parameter type");
             }
@@ -112,5 +367,7 @@ namespace hosting::db
         template <typename T>
         struct always_false : std::false_type {};
         sqlite3 *db_ {nullptr};
+        std::unordered_map<std::string, std::shared_ptr<statement>> statements_;
+        unsigned int savepoints_{0};
     };
-}
\ No newline at end of file
+}
@@ -1,31 +1,63 @@
 #pragma once
 
-#include "sqlite.hpp"
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "database.hpp"
 #include "../../structural/key_value.hpp"
 
 namespace hosting::db {
     struct sqlite_keyval {
         sqlite_keyval(const std::string &path) : db_{path} {
             // ensure the table exists
-            db_.ensure_table("keyval", "key TEXT PRIMARY KEY, value TEXT");
+            db_.write([](sqlite &db) {
+                db.ensure_table("keyval", "key TEXT PRIMARY KEY, value TEXT");
+            }).get();
         }
 
+        // waits for the writer, so a get() right after sees the value
         void set(std::string const &key, std::optional<std::string> const &value) {
-            if (value) {
-                db_.exec(std::format("INSERT OR REPLACE INTO keyval (key, value) VALUES ('{}', '{}')", key, *value));
-            }
-            else {
-                db_.exec(std::format("DELETE FROM keyval WHERE key = '{}'", key));
-            }
+            db_.write([&key, &value](sqlite &db) {
+                if (value) {
+                    db.exec("INSERT INTO keyval (key, value) VALUES (?, ?) ON CONFLICT(key) DO UPDATE SET value=excluded.value", {}, key, *value);
+                }
+                else {
+                    db.exec("DELETE FROM keyval WHERE key = ?", {}, key);
+                }
+            }).get();
         }
 
+        std::optional<std::string> get(std::string const &key) {
+            return db_.read([&key](sqlite &db) {
+                return db.query_value<std::string>("SELECT value FROM keyval WHERE key = ?", key);
+            });
+        }
+
+        // the keys that start with name_base
         void scan_level(std::string_view name_base, auto sink) {
-            db_.exec(std::format("SELECT key FROM keyval WHERE key LIKE '{}%'", name_base), [&sink](int, char **data, char **columns) {
-                sink(data[0]);
-                return 0;
+            // match the prefix literally, '%' and '_' included
+            std::string pattern;
+            for (auto const c : name_base) {
+                if (c == '%' || c == '_' || c == '\\') pattern += '\\';
+                pattern += c;
+            }
+            pattern += '%';
+            auto const keys = db_.read([&pattern](sqlite &db) {
+                std::vector<std::string> result;
+                for (auto const &[key] : db.query<std::string>("SELECT key FROM keyval WHERE key LIKE ? ESCAPE '\\'", pattern)) {
+                    result.push_back(key);
+                }
+                return result;
             });
+            for (auto const &key : keys) {
+                sink(key);
+            }
         }
     private:
-        sqlite db_;
+        database db_;
     };
+
+    static_assert(KeyValue<sqlite_keyval>);
 }
@@ -124,11 +124,16 @@ namespace hosting::ssh
             return docker().execute_command(command, localhost, use_sudo);
         }
 
+        void stream_command(std::string const &command, std::shared_ptr<local::host> localhost, ssh_execute::chunk_sink_t sink, bool use_sudo = true)
+        {
+            localhost->ssh_stream(std::format("{} {}", use_sudo ? "sudo" : "", command), name_, std::move(sink));
+        }
+
         std::string get_os_release(std::shared_ptr<local::host> localhost)
         {
             if (os_release_.empty())
             {
-                os_release_ = execute_command("cat /etc/os-release", localhost);
+                os_release_ = localhost->ssh_probe("sudo cat /etc/os-release", name_);
             }
             return os_release_;
         }
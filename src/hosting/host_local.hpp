@@ -15,6 +15,8 @@
 #include <curl/curl.h>
 
 #include "ssh_execute.hpp"
+#include "ssh_batch.hpp"
+#include "ssh_sessions.hpp"
 #include "local_process.hpp"
 
 namespace hosting::local
@@ -58,7 +60,11 @@ namespace hosting::local
 
         void set_env_variable(std::string const &key, std::string const &value)
         {
+#if defined(_WIN32)
             _putenv_s(key.c_str(), value.c_str());
+#else
+            ::setenv(key.c_str(), value.c_str(), 1);
+#endif
         }
 
         std::string resolve_environment(std::string source) {
@@ -91,95 +97,65 @@ namespace hosting::local
 
         void open_content(std::string const &content)
         {
+#if defined(_WIN32)
             ShellExecuteA(nullptr, "open", content.c_str(), nullptr, nullptr, SW_SHOWNORMAL);
+#else
+            run(std::format("xdg-open {}", ssh_batcher::quote(content)));
+#endif
         }
 
+        // runs the command on its own channel, in the remote user's login shell
         std::string ssh(std::string_view command, std::string_view host_name, unsigned int timeout_seconds = 5)
         {
-            std::string key{host_name};
-            if (sessions.find(key) == sessions.end())
-            {
-                sessions[key] = std::make_unique<ssh_execute>(std::string{host_name}, timeout_seconds);
-            }
-            return sessions.at(key)->execute_command(std::string{command});
+            return sessions.get(host_name, timeout_seconds)->execute_command(std::string{command});
         }
 
-        void recycle_session(std::string_view host_name)
+        // For the short, POSIX sh probes the app itself issues (os-release, systemctl, ps):
+        // they may wait a few ms to share one round-trip with other probes for the host.
+        std::string ssh_probe(std::string_view command, std::string_view host_name, unsigned int timeout_seconds = 5)
         {
-            std::string key{host_name};
-            sessions.erase(key);
+            return batcher.run(host_name, std::string{command}, timeout_seconds).output;
         }
 
-        bool has_session(std::string_view host_name)
+        // streams the remote output as it arrives; the sink returns false to cancel
+        void ssh_stream(std::string_view command, std::string_view host_name, ssh_execute::chunk_sink_t sink, unsigned int timeout_seconds = 5,
+            ssh_execute::channel_kind kind = ssh_execute::channel_kind::pooled)
         {
-            std::string key{host_name};
-            return sessions.find(key) != sessions.end();
+            sessions.get(host_name, timeout_seconds)->execute_command(std::string{command}, std::move(sink), kind);
         }
 
-        std::string execute_command(std::string_view command, bool include_stderr = true)
+        void stream_command(std::string_view command, running_process::chunk_sink_t sink, bool include_stderr = true)
         {
-            std::string result;
-            execute_command(command, [&result](std::string_view line)
-                            { result += line; }, include_stderr);
-            return result;
+            auto proc{run(command, include_stderr)};
+            proc->read_until(std::move(sink));
         }
 
-        bool IsPortInUse(unsigned short port) const
+        void recycle_session(std::string_view host_name)
         {
-            WSADATA wsaData;
-            SOCKET TestSocket = INVALID_SOCKET;
-            struct sockaddr_in service;
-
-            // Initialize Winsock
-            int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
-            if (iResult != 0)
-            {
-                return false; // Winsock init failed, assume port is not in use
-            }
+            sessions.recycle(host_name);
+        }
 
-            // Create a SOCKET for connecting to the server
-            TestSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-            if (TestSocket == INVALID_SOCKET)
-            {
-                WSACleanup();
-                return false; // Socket creation failed, assume port is not in use
-            }
+        bool has_session(std::string_view host_name)
+        {
+            return sessions.has(host_name);
+        }
 
-            // Set up the sockaddr_in structure
-            service.sin_family = AF_INET;
-            if (inet_pton(AF_INET, "127.0.0.1", &service.sin_addr) <= 0)
-            {
-                closesocket(TestSocket);
-                WSACleanup();
-                return false; // Address conversion failed, assume port is not in use
-            }
-            service.sin_port = htons(port); // Convert port number
+        auto &session_pool()
+        {
+            return sessions;
+        }
 
-            // Attempt to connect to the port
-            iResult = connect(TestSocket, (SOCKADDR *)&service, sizeof(service));
-            if (iResult == SOCKET_ERROR)
-            {
-                // If the error is WSAECONNREFUSED or WSAETIMEDOUT, port is not in use
-                int errCode = WSAGetLastError();
-                if (errCode == WSAECONNREFUSED || errCode == WSAETIMEDOUT)
-                {
-                    closesocket(TestSocket);
-                    WSACleanup();
-                    return false; // Port is not in use
-                }
-            }
-            else
-            {
-                // Connection succeeded, meaning the port is in use
-                closesocket(TestSocket);
-                WSACleanup();
-                return true; // Port is in use
-            }
+        auto &ssh_batching()
+        {
+            return batcher;
+        }
 
-            // Cleanup
-            closesocket(TestSocket);
-            WSACleanup();
-            return false; // Port is not in use
+        std::string execute_command(std::string_view command, bool include_stderr = true)
+        {
+            std::string result;
+            execute_command(command, [&result](std::string_view line)
+                            { result += line; }, include_stderr);
+            return result;
         }
 
         std::string HostName()
@@ -218,6 +194,9 @@ namespace hosting::local
 
     private:
         std::string hostname;
-        std::unordered_map<std::string, std::unique_ptr<ssh_execute>> sessions;
+        local::ssh_sessions sessions;
+        ssh_batcher batcher{[this](std::string_view host_name, std::string const &command, unsigned int timeout_seconds) {
+            return ssh(command, host_name, timeout_seconds);
+        }};
     };
 }
\ No newline at end of file
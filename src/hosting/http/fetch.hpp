@@ -1,9 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <exception>
 #include <format>
 #include <functional>
 #include <stdexcept>
+#include <stop_token>
 #include <string>
+#include <string_view>
 
 #include <curl/curl.h>
 
@@ -121,7 +125,106 @@ namespace http {
             }
             throw std::runtime_error("Error: curl_easy_init failed.");
         }
+        // Posts and hands the response body to sink as it arrives, for replies streamed as
+        // server-sent events. Returns false when stop was requested before the end.
+        bool post_stream(
+            std::string const &url,
+            std::string const &data,
+            header_client_t header_client,
+            std::function<void(std::string_view)> const &sink,
+            std::stop_token stop = {}) const {
+            CURL *curl = curl_easy_init();
+            if (!curl) {
+                throw std::runtime_error("Error: curl_easy_init failed.");
+            }
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(curl, CURLOPT_USERAGENT, "beat-o-graph/1.0");
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout_);
+            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 15L);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data.c_str());
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, data.size());
+            char *pproxy_str = nullptr;
+            size_t len = 0;
+            if (!_dupenv_s(&pproxy_str, &len, "HTTP_PROXY") && pproxy_str != nullptr) {
+                curl_easy_setopt(curl, CURLOPT_PROXY, pproxy_str);
+            }
+            struct curl_slist *headers = nullptr;
+            if (header_client) {
+                header_client([&headers](std::string const& header_value) {
+                    headers = curl_slist_append(headers, header_value.c_str());
+                });
+                if (headers) {
+                    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+                }
+            }
+            stream_state_t state{curl, sink, stop};
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fetch::write_stream);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &state);
+            // while nothing arrives only the progress callback gets called, so it watches stop too
+            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, fetch::stream_progress);
+            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &state);
+            auto const cr = curl_easy_perform(curl);
+            long response_code {0};
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+            curl_slist_free_all(headers);
+            curl_easy_cleanup(curl);
+            if (state.error) {
+                std::rethrow_exception(state.error);
+            }
+            if (stop.stop_requested() && (cr == CURLE_ABORTED_BY_CALLBACK || cr == CURLE_WRITE_ERROR)) {
+                return false;
+            }
+            if (cr != CURLE_OK) {
+                throw std::runtime_error(std::format("Error: {}", curl_easy_strerror(cr)));
+            }
+            if (response_code != 200) {
+                throw std::runtime_error(std::format("Error: HTTP response code {} {}", response_code, state.error_body));
+            }
+            return true;
+        }
+
     private:
+        struct stream_state_t {
+            CURL *curl;
+            std::function<void(std::string_view)> const &sink;
+            std::stop_token stop;
+            // what a failed request said, not meant for sink
+            std::string error_body;
+            std::exception_ptr error;
+        };
+
+        static size_t write_stream(void *ptr, size_t size, size_t nmemb, void *data) {
+            auto &state = *static_cast<stream_state_t *>(data);
+            if (state.stop.stop_requested()) {
+                // taking less than we were given aborts the transfer
+                return 0;
+            }
+            std::string_view const chunk {static_cast<char *>(ptr), size * nmemb};
+            long response_code {0};
+            curl_easy_getinfo(state.curl, CURLINFO_RESPONSE_CODE, &response_code);
+            if (response_code != 200) {
+                state.error_body.append(chunk.substr(0, std::min(chunk.size(), max_error_body - std::min(max_error_body, state.error_body.size()))));
+                return size * nmemb;
+            }
+            try {
+                state.sink(chunk);
+            }
+            catch (...) {
+                // exceptions must not cross curl, post_stream rethrows it
+                state.error = std::current_exception();
+                return 0;
+            }
+            return size * nmemb;
+        }
+
+        static int stream_progress(void *data, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+            return static_cast<stream_state_t *>(data)->stop.stop_requested() ? 1 : 0;
+        }
+
+        static constexpr size_t max_error_body {4096};
+
         static size_t write_string(void *ptr, size_t size, size_t nmemb, void *data) {
             auto *pdata = static_cast<std::string *>(data);
             pdata->append(static_cast<char *>(ptr), size * nmemb);
@@ -1,68 +1,318 @@
 #pragma once
 
+#include <cerrno>
+#include <chrono>
 #include <format>
+#include <iostream>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <stdexcept>
-#include "host_local.hpp"
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "host_local.hpp"
 
 namespace hosting::local
 {
+    namespace sockets
+    {
+#if defined(_WIN32)
+        using socket_t = SOCKET;
+        constexpr socket_t invalid_socket{INVALID_SOCKET};
+        inline void close(socket_t s) { ::closesocket(s); }
+        inline int poll(WSAPOLLFD *fds, size_t count, int timeout_ms) { return ::WSAPoll(fds, static_cast<ULONG>(count), timeout_ms); }
+        using pollfd_t = WSAPOLLFD;
+        using socklen_t = int;
+        constexpr int send_flags{0};
+        inline void set_nonblocking(socket_t s) { u_long on{1}; ::ioctlsocket(s, FIONBIO, &on); }
+        inline bool would_block() { return ::WSAGetLastError() == WSAEWOULDBLOCK; }
+
+        // WSAStartup is reference counted, every mapping holds one reference
+        struct runtime
+        {
+            runtime()
+            {
+                WSADATA data;
+                if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+                {
+                    throw std::runtime_error("Error: could not initialize Winsock");
+                }
+            }
+            ~runtime() { WSACleanup(); }
+        };
+#else
+        using socket_t = int;
+        constexpr socket_t invalid_socket{-1};
+        inline void close(socket_t s) { ::close(s); }
+        inline int poll(::pollfd *fds, size_t count, int timeout_ms) { return ::poll(fds, static_cast<nfds_t>(count), timeout_ms); }
+        using pollfd_t = ::pollfd;
+        using socklen_t = ::socklen_t;
+        // a client that went away must not raise SIGPIPE
+        constexpr int send_flags{MSG_NOSIGNAL};
+        inline void set_nonblocking(socket_t s) { ::fcntl(s, F_SETFL, ::fcntl(s, F_GETFL, 0) | O_NONBLOCK); }
+        inline bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+        struct runtime {};
+#endif
+    }
+
+    // Forwards a local port to mapped_port on hostname through a direct-tcpip channel of the
+    // pooled ssh session for that host, so many mappings share one authenticated connection.
+    // The kernel picks a free loopback port, and a single thread pumps every connection
+    // with non-blocking sockets and writes, buffering per connection in both directions.
     struct mapping
     {
         mapping(unsigned short port, const std::string &hostname, std::shared_ptr<host> localhost)
             : mapped_port_{port}, hostname_{hostname}, localhost_{localhost}
         {
             std::cerr << "Starting port mapping for " << hostname_ << " port " << mapped_port_ << std::endl;
-            // Find an available port
-            local_port_ = 0;
+            listener_ = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (listener_ == sockets::invalid_socket)
             {
-                static unsigned short watermark_{10000};
-                static std::mutex port_mutex;
-                std::lock_guard<std::mutex> lock(port_mutex);
-
-                for (unsigned short port_candidate = watermark_; port_candidate < 65535; ++port_candidate)
-                {
-                    if (!localhost_->IsPortInUse(port_candidate))
-                    {
-                        local_port_ = port_candidate;
-                        break;
-                    }
-                }
-                // If no port is available, throw an exception
-                if (local_port_ == 0)
-                {
-                    throw std::runtime_error("No available ports found!");
-                }
-                watermark_ = local_port_ + 1;
+                throw std::runtime_error("Error: could not create listening socket");
+            }
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = 0;
+            sockets::socklen_t length{sizeof(address)};
+            if (::bind(listener_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+                ::listen(listener_, SOMAXCONN) != 0 ||
+                ::getsockname(listener_, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+            {
+                sockets::close(listener_);
+                throw std::runtime_error(std::format("Error: could not listen for the mapping of {}:{}", hostname_, mapped_port_));
             }
-            // Map the port
-            std::string command = std::format("ssh -o ConnectTimeout=10 -N -L {0}:localhost:{1} {2}", local_port_, mapped_port_, hostname_);
-            process_ = localhost->run(command.c_str());
+            local_port_ = ntohs(address.sin_port);
+            pump_ = std::jthread{[this](std::stop_token stop) { run(stop); }};
         }
+
         ~mapping()
         {
             std::cerr << "Stopping port mapping for " << hostname_ << " port " << mapped_port_ << std::endl;
-            process_->sendQuitSignal(CTRL_C_EVENT);
-            process_->wait(400);
-            process_->sendQuitSignal(CTRL_BREAK_EVENT);
-            process_->wait(400);
-            process_->stop();
-            process_->wait(1000);
+            pump_.request_stop();
+            if (pump_.joinable())
+            {
+                pump_.join();
+            }
+            sockets::close(listener_);
         }
+
         unsigned short mapped_port() const { return mapped_port_; }
         unsigned short local_port() const { return local_port_; }
         auto localhost() const { return localhost_; }
         auto hostname() const { return hostname_; }
 
     private:
+        static constexpr size_t buffer_size{64 * 1024};
+        // Channel data does not always wake up poll: the session socket may be drained by
+        // another thread's channel. So while connections are open poll still times out now
+        // and then; with none, it only wakes up to notice a stop request.
+        static constexpr int active_poll_ms{50};
+        static constexpr int idle_poll_ms{1000};
+
+        struct connection_t
+        {
+            sockets::socket_t socket;
+            std::shared_ptr<ssh_execute> session;
+            // null until the session has a free channel for it
+            std::unique_ptr<ssh_execute::tunnel_t> tunnel;
+            // received from the client, not yet taken by the channel window
+            std::string to_remote;
+            // read from the channel, not yet taken by the client socket
+            std::string to_client;
+            bool remote_closed{false};
+
+            ~connection_t()
+            {
+                tunnel.reset();
+                sockets::close(socket);
+            }
+        };
+
+        void accept_one(std::vector<std::unique_ptr<connection_t>> &connections)
+        {
+            auto const client = ::accept(listener_, nullptr, nullptr);
+            if (client == sockets::invalid_socket)
+            {
+                return;
+            }
+            try
+            {
+                sockets::set_nonblocking(client);
+                // fetched per connection, so a session reaped or recycled meanwhile is reopened
+                auto session = localhost_->session_pool().get(hostname_);
+                connections.push_back(std::make_unique<connection_t>(client, std::move(session)));
+            }
+            catch (std::exception const &e)
+            {
+                std::cerr << std::format("Error forwarding port {} on {}: {}", mapped_port_, hostname_, e.what()) << std::endl;
+                sockets::close(client);
+            }
+        }
+
+        // moves whatever can move without blocking; returns false once the connection is done
+        bool pump(connection_t &connection, short revents, std::vector<char> &buffer, bool &moved)
+        {
+            if (!connection.tunnel)
+            {
+                if (revents & (POLLHUP | POLLERR))
+                {
+                    return false;
+                }
+                connection.tunnel = connection.session->open_tunnel("localhost", mapped_port_, local_port_);
+                if (!connection.tunnel)
+                {
+                    return true;
+                }
+            }
+            if (revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                if (connection.to_remote.size() >= buffer_size)
+                {
+                    // hung up with data the channel never took
+                    return !(revents & (POLLHUP | POLLERR));
+                }
+                auto const received = ::recv(connection.socket, buffer.data(), static_cast<int>(buffer_size - connection.to_remote.size()), 0);
+                if (received == 0 || (received < 0 && !sockets::would_block()))
+                {
+                    return false;
+                }
+                if (received > 0)
+                {
+                    connection.to_remote.append(buffer.data(), static_cast<size_t>(received));
+                    moved = true;
+                }
+            }
+            if (!connection.to_remote.empty())
+            {
+                auto const written = connection.tunnel->write_some(connection.to_remote);
+                if (written < 0)
+                {
+                    return false;
+                }
+                connection.to_remote.erase(0, static_cast<size_t>(written));
+                moved = moved || written > 0;
+            }
+            if (!connection.remote_closed && connection.to_client.size() < buffer_size)
+            {
+                auto const nbytes = connection.tunnel->read(buffer.data(), buffer_size - connection.to_client.size());
+                if (nbytes < 0)
+                {
+                    connection.remote_closed = true;
+                }
+                else if (nbytes > 0)
+                {
+                    connection.to_client.append(buffer.data(), static_cast<size_t>(nbytes));
+                    moved = true;
+                }
+            }
+            if (!connection.to_client.empty())
+            {
+                auto const sent = ::send(connection.socket, connection.to_client.data(), static_cast<int>(connection.to_client.size()), sockets::send_flags);
+                if (sent < 0 && !sockets::would_block())
+                {
+                    return false;
+                }
+                if (sent > 0)
+                {
+                    connection.to_client.erase(0, static_cast<size_t>(sent));
+                    moved = true;
+                }
+            }
+            // whatever the remote sent before closing is delivered first
+            return !(connection.remote_closed && connection.to_client.empty());
+        }
+
+        void run(std::stop_token stop)
+        {
+            std::vector<std::unique_ptr<connection_t>> connections;
+            std::vector<sockets::pollfd_t> fds;
+            std::unordered_set<sockets::socket_t> session_sockets;
+            std::vector<char> buffer(buffer_size);
+            bool moved{false};
+            while (!stop.stop_requested())
+            {
+                fds.clear();
+                fds.push_back({listener_, POLLIN, 0});
+                session_sockets.clear();
+                for (auto const &connection : connections)
+                {
+                    short events{0};
+                    // nothing is read from the client until its channel is open
+                    if (connection->tunnel && connection->to_remote.size() < buffer_size)
+                    {
+                        events |= POLLIN;
+                    }
+                    if (!connection->to_client.empty())
+                    {
+                        events |= POLLOUT;
+                    }
+                    fds.push_back({connection->socket, events, 0});
+                    // a connection that is not reading the channel must not wake on it
+                    if (connection->tunnel && !connection->remote_closed && connection->to_client.size() < buffer_size)
+                    {
+                        if (auto const fd = connection->session->socket(); fd != SSH_INVALID_SOCKET)
+                        {
+                            session_sockets.insert(static_cast<sockets::socket_t>(fd));
+                        }
+                    }
+                }
+                for (auto const fd : session_sockets)
+                {
+                    fds.push_back({fd, POLLIN, 0});
+                }
+                auto const timeout = moved ? 0 : connections.empty() ? idle_poll_ms : active_poll_ms;
+                if (sockets::poll(fds.data(), fds.size(), timeout) < 0)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds{active_poll_ms});
+                    continue;
+                }
+                moved = false;
+                for (size_t i = connections.size(); i-- > 0;)
+                {
+                    bool done;
+                    try
+                    {
+                        done = !pump(*connections[i], fds[i + 1].revents, buffer, moved);
+                    }
+                    catch (std::exception const &e)
+                    {
+                        std::cerr << std::format("Error forwarding port {} on {}: {}", mapped_port_, hostname_, e.what()) << std::endl;
+                        done = true;
+                    }
+                    if (done)
+                    {
+                        connections.erase(connections.begin() + i);
+                    }
+                }
+                if (fds[0].revents & POLLIN)
+                {
+                    accept_one(connections);
+                }
+            }
+        }
+
+        sockets::runtime runtime_;
         unsigned short mapped_port_;
-        unsigned short local_port_;
+        unsigned short local_port_{0};
         std::string hostname_;
         std::shared_ptr<host> localhost_;
-        std::unique_ptr<running_process> process_;
+        sockets::socket_t listener_{sockets::invalid_socket};
+        std::jthread pump_;
     };
 }
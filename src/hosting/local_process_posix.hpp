@@ -0,0 +1,349 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "process_reactor.hpp"
+
+extern char **environ;
+
+namespace hosting::local
+{
+    // A child started with /bin/sh -c. Its stdout and stderr come through separate
+    // non-blocking pipes read by the shared process_reactor; callers of read_until only
+    // wait for chunks to be queued, so many children cost a single reader thread.
+    struct running_process
+    {
+        using sink_t = std::function<void(std::string_view)>;
+        using chunk_sink_t = std::function<bool(std::string_view)>;
+        using environment_getter_t = std::function<std::string(std::string_view)>;
+
+        static constexpr int wait_timeout{-1};
+
+        running_process(std::string_view command, environment_getter_t env, bool include_stderr = true)
+            : include_stderr_{include_stderr}, output_{std::make_shared<output_t>()}
+        {
+            int out[2]{-1, -1}, err[2]{-1, -1};
+            if (!make_pipe(out) || !make_pipe(err))
+            {
+                close_all({out[0], out[1], err[0], err[1]});
+                throw std::runtime_error(std::format("pipe failed! Error description: {}", std::strerror(errno)));
+            }
+            for (auto fd : {out[0], err[0]})
+            {
+                ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            }
+
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(&actions);
+            posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+            posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+            posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+            posix_spawn_file_actions_addclose(&actions, out[1]);
+            posix_spawn_file_actions_addclose(&actions, err[1]);
+
+            auto const command_str = env(std::string{command.data(), command.size()});
+            char const *argv[]{"/bin/sh", "-c", command_str.c_str(), nullptr};
+            auto const rc = posix_spawn(&pid_, "/bin/sh", &actions, nullptr, const_cast<char *const *>(argv), environ);
+            posix_spawn_file_actions_destroy(&actions);
+            // the parent keeps the read ends only, so eof shows up when the child exits
+            close_all({out[1], err[1]});
+            if (rc != 0)
+            {
+                close_all({out[0], err[0]});
+                throw std::runtime_error(std::format("posix_spawn failed! Error code: {} Error description: {}", rc, std::strerror(rc)));
+            }
+
+            output_->fds[0] = out[0];
+            output_->fds[1] = err[0];
+            output_->open_streams = 2;
+            auto &reactor = process_reactor::instance();
+            for (int stream = 0; stream < 2; ++stream)
+            {
+                reactor.add(output_->fds[stream], output_.get(), [output = output_, stream](int fd) {
+                    return output->on_readable(fd, stream == 1);
+                });
+            }
+        }
+
+        running_process(running_process const &) = delete;
+
+        ~running_process()
+        {
+            close_pipes();
+            if (pid_ > 0 && ::waitpid(pid_, nullptr, WNOHANG) == 0)
+            {
+                process_reactor::instance().adopt(pid_);
+            }
+        }
+
+        // Drops whatever output is left without waiting for it; a child still writing gets
+        // EPIPE, and the destructor hands it to the reactor to be reaped.
+        void close_pipes()
+        {
+            if (!drained_)
+            {
+                cancel();
+            }
+        }
+
+        // returns the exit code (128 + signal when killed), or wait_timeout
+        int wait(int milliseconds = -1)
+        {
+            if (pid_ > 0)
+            {
+                int status{0};
+                auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{milliseconds};
+                for (;;)
+                {
+                    auto const res = ::waitpid(pid_, &status, milliseconds < 0 ? 0 : WNOHANG);
+                    if (res == pid_)
+                    {
+                        exit_code_ = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                        pid_ = -1;
+                        break;
+                    }
+                    if (res < 0 && errno != EINTR)
+                    {
+                        pid_ = -1;
+                        break;
+                    }
+                    if (res == 0 && std::chrono::steady_clock::now() >= deadline)
+                    {
+                        return wait_timeout;
+                    }
+                    if (res == 0)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds{5});
+                    }
+                }
+            }
+            return exit_code_;
+        }
+
+        void stop()
+        {
+            if (pid_ > 0)
+            {
+                cancel();
+                if (::kill(pid_, SIGKILL) != 0 && errno != ESRCH)
+                {
+                    throw std::runtime_error(std::format("kill failed! Error code: {} Error description: {}", errno, std::strerror(errno)));
+                }
+            }
+        }
+
+        void sendQuitSignal(int code = SIGINT)
+        {
+            if (pid_ > 0)
+            {
+                ::kill(pid_, code);
+            }
+        }
+
+        void read_all(sink_t sink, int timeout = 5000)
+        {
+            read_until([&sink](std::string_view contents) {
+                sink(contents);
+                return true;
+            }, timeout);
+        }
+
+        // Delivers stdout, and stderr too when include_stderr was set, as the reactor reads it;
+        // stops and closes the pipes as soon as the sink returns false. The timeout applies to
+        // each wait for more output, like the Windows version.
+        void read_until(chunk_sink_t sink, int timeout = 5000)
+        {
+            while (!drained_)
+            {
+                chunk_t chunk;
+                {
+                    std::unique_lock lock{output_->mutex};
+                    if (!output_->cv.wait_for(lock, std::chrono::milliseconds{timeout}, [this] {
+                            return !output_->chunks.empty() || output_->open_streams == 0;
+                        }))
+                    {
+                        throw std::runtime_error("Read operation timed out!");
+                    }
+                    if (output_->chunks.empty())
+                    {
+                        drained_ = true;
+                        break;
+                    }
+                    chunk = std::move(output_->chunks.front());
+                    output_->chunks.pop_front();
+                    output_->buffered -= chunk.data.size();
+                    resume_if_drained(lock);
+                }
+                if (chunk.is_stderr && !include_stderr_)
+                {
+                    error_output_.append(chunk.data);
+                    if (error_output_.size() > max_error_output)
+                    {
+                        error_output_.erase(0, error_output_.size() - max_error_output);
+                    }
+                    continue;
+                }
+                if (!sink(chunk.data))
+                {
+                    cancel();
+                    break;
+                }
+            }
+        }
+
+        // what the child wrote to stderr when it was not merged into the output, last 64 KiB
+        std::string const &error_output() const { return error_output_; }
+
+    private:
+        static constexpr size_t read_buffer{65536};
+        static constexpr size_t max_buffered{1024 * 1024};
+        static constexpr size_t max_error_output{65536};
+
+        struct chunk_t
+        {
+            std::string data;
+            bool is_stderr{false};
+        };
+
+        // shared with the reactor handlers, which may outlive the process object
+        struct output_t
+        {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<chunk_t> chunks;
+            size_t buffered{0};
+            int open_streams{0};
+            int fds[2]{-1, -1};
+            bool paused[2]{false, false};
+            bool cancelled{false};
+
+            // reactor thread; reads until the pipe is empty, 64 KiB at a time
+            process_reactor::readiness on_readable(int fd, bool is_stderr)
+            {
+                thread_local std::vector<char> buffer(read_buffer);
+                for (;;)
+                {
+                    auto const nbytes = ::read(fd, buffer.data(), buffer.size());
+                    std::lock_guard lock{mutex};
+                    if (cancelled)
+                    {
+                        return process_reactor::readiness::done;
+                    }
+                    if (nbytes > 0)
+                    {
+                        chunks.push_back({std::string{buffer.data(), static_cast<size_t>(nbytes)}, is_stderr});
+                        buffered += static_cast<size_t>(nbytes);
+                        cv.notify_all();
+                        if (buffered > max_buffered)
+                        {
+                            paused[is_stderr ? 1 : 0] = true;
+                            return process_reactor::readiness::pause;
+                        }
+                        continue;
+                    }
+                    if (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    {
+                        return process_reactor::readiness::keep;
+                    }
+                    if (nbytes < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    fds[is_stderr ? 1 : 0] = -1;
+                    --open_streams;
+                    cv.notify_all();
+                    return process_reactor::readiness::done;
+                }
+            }
+        };
+
+        // requires output_->mutex
+        void resume_if_drained(std::unique_lock<std::mutex> &)
+        {
+            if (output_->buffered > max_buffered / 2)
+            {
+                return;
+            }
+            for (int stream = 0; stream < 2; ++stream)
+            {
+                if (output_->paused[stream] && output_->fds[stream] >= 0)
+                {
+                    output_->paused[stream] = false;
+                    process_reactor::instance().resume(output_->fds[stream], output_.get());
+                }
+            }
+        }
+
+        void cancel()
+        {
+            drained_ = true;
+            std::lock_guard lock{output_->mutex};
+            output_->cancelled = true;
+            for (auto &fd : output_->fds)
+            {
+                if (fd >= 0)
+                {
+                    process_reactor::instance().remove(fd, output_.get());
+                    fd = -1;
+                }
+            }
+            output_->chunks.clear();
+            output_->buffered = 0;
+        }
+
+        // close-on-exec on both ends, so children spawned concurrently don't inherit them;
+        // dup2 in the spawn actions clears the flag on the child's stdout and stderr
+        static bool make_pipe(int (&fds)[2])
+        {
+#if defined(__linux__)
+            return ::pipe2(fds, O_CLOEXEC) == 0;
+#else
+            if (::pipe(fds) != 0)
+            {
+                return false;
+            }
+            ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+            return true;
+#endif
+        }
+
+        static void close_all(std::initializer_list<int> fds)
+        {
+            for (auto fd : fds)
+            {
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                }
+            }
+        }
+
+        bool include_stderr_;
+        std::shared_ptr<output_t> output_;
+        pid_t pid_{-1};
+        int exit_code_{0};
+        bool drained_{false};
+        std::string error_output_;
+    };
+}
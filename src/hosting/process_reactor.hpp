@@ -0,0 +1,257 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+namespace hosting::local
+{
+    // Owns the read ends of every child process pipe and reads them from a single thread,
+    // epoll on Linux and poll elsewhere, instead of one blocked reader per process.
+    // All fd bookkeeping happens on the reactor thread; other threads post requests.
+    struct process_reactor
+    {
+        enum class readiness
+        {
+            keep,  // still interested in the fd
+            pause, // consumer is behind, stop reading until resume()
+            done   // eof or cancelled, close the fd
+        };
+        using handler_t = std::function<readiness(int fd)>;
+
+        static process_reactor &instance()
+        {
+            // never destroyed: the detached reactor thread keeps using it until the process exits
+            static auto reactor = new process_reactor;
+            return *reactor;
+        }
+
+        process_reactor(process_reactor const &) = delete;
+
+        // Takes ownership of fd, which must be non-blocking. The owner tags the registration
+        // because fd numbers are reused once the reactor closes them.
+        void add(int fd, void const *owner, handler_t handler)
+        {
+            post([this, fd, owner, handler = std::move(handler)]() mutable {
+                handlers_[fd] = {std::move(handler), owner, true};
+                watch(fd, true);
+            });
+        }
+
+        void resume(int fd, void const *owner)
+        {
+            post([this, fd, owner] {
+                if (auto it = handlers_.find(fd); it != handlers_.end() && it->second.owner == owner && !it->second.active)
+                {
+                    it->second.active = true;
+                    watch(fd, true);
+                }
+            });
+        }
+
+        // closes fd; its handler is not called again
+        void remove(int fd, void const *owner)
+        {
+            post([this, fd, owner] {
+                if (auto it = handlers_.find(fd); it != handlers_.end() && it->second.owner == owner)
+                {
+                    drop(fd);
+                }
+            });
+        }
+
+        // reaps a child nobody is going to wait for, so it does not linger as a zombie
+        void adopt(pid_t pid)
+        {
+            post([this, pid] { orphans_.push_back(pid); });
+        }
+
+    private:
+        struct entry_t
+        {
+            handler_t handler;
+            void const *owner;
+            bool active;
+        };
+
+        process_reactor()
+        {
+            int wake[2];
+            if (::pipe(wake) != 0)
+            {
+                throw std::runtime_error("Error: could not create the process reactor wakeup pipe");
+            }
+            wake_read_ = wake[0];
+            wake_write_ = wake[1];
+            for (auto fd : wake)
+            {
+                ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+                ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+#if defined(__linux__)
+            epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+            if (epoll_ < 0)
+            {
+                throw std::runtime_error("Error: could not create the process reactor epoll instance");
+            }
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = wake_read_;
+            ::epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_read_, &event);
+#endif
+            std::thread([this] { run(); }).detach();
+        }
+
+        void post(std::function<void()> request)
+        {
+            {
+                std::lock_guard lock{mutex_};
+                requests_.push_back(std::move(request));
+            }
+            char const signal{1};
+            [[maybe_unused]] auto const written = ::write(wake_write_, &signal, 1);
+        }
+
+        // reactor thread only; paused fds leave the epoll set, since hangups are reported regardless of the mask
+        void watch(int fd, bool enabled)
+        {
+#if defined(__linux__)
+            if (enabled)
+            {
+                epoll_event event{};
+                event.events = EPOLLIN;
+                event.data.fd = fd;
+                ::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+            }
+            else
+            {
+                ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+            }
+#else
+            (void)fd, (void)enabled;
+#endif
+        }
+
+        // reactor thread only
+        void drop(int fd)
+        {
+            if (handlers_.erase(fd) > 0)
+            {
+#if defined(__linux__)
+                ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+                ::close(fd);
+            }
+        }
+
+        void dispatch(int fd)
+        {
+            auto it = handlers_.find(fd);
+            if (it == handlers_.end() || !it->second.active)
+            {
+                return;
+            }
+            switch (it->second.handler(fd))
+            {
+            case readiness::keep:
+                break;
+            case readiness::pause:
+                it->second.active = false;
+                watch(fd, false);
+                break;
+            case readiness::done:
+                drop(fd);
+                break;
+            }
+        }
+
+        void run()
+        {
+            std::vector<std::function<void()>> requests;
+#if defined(__linux__)
+            std::vector<epoll_event> events(64);
+#else
+            std::vector<pollfd> fds;
+#endif
+            for (;;)
+            {
+                auto const timeout_ms = orphans_.empty() ? -1 : 250;
+                std::vector<int> ready;
+#if defined(__linux__)
+                auto const count = ::epoll_wait(epoll_, events.data(), static_cast<int>(events.size()), timeout_ms);
+                for (int i = 0; i < count; ++i)
+                {
+                    ready.push_back(events[i].data.fd);
+                }
+#else
+                fds.clear();
+                fds.push_back({wake_read_, POLLIN, 0});
+                for (auto const &[fd, entry] : handlers_)
+                {
+                    if (entry.active)
+                    {
+                        fds.push_back({fd, POLLIN, 0});
+                    }
+                }
+                if (::poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout_ms) > 0)
+                {
+                    for (auto const &p : fds)
+                    {
+                        if (p.revents != 0)
+                        {
+                            ready.push_back(p.fd);
+                        }
+                    }
+                }
+#endif
+                for (auto fd : ready)
+                {
+                    if (fd == wake_read_)
+                    {
+                        char drain[64];
+                        while (::read(wake_read_, drain, sizeof(drain)) > 0)
+                        {
+                        }
+                        continue;
+                    }
+                    dispatch(fd);
+                }
+                {
+                    std::lock_guard lock{mutex_};
+                    requests.swap(requests_);
+                }
+                for (auto &request : requests)
+                {
+                    request();
+                }
+                requests.clear();
+                std::erase_if(orphans_, [](pid_t pid) { return ::waitpid(pid, nullptr, WNOHANG) != 0; });
+            }
+        }
+
+        std::mutex mutex_;
+        std::vector<std::function<void()>> requests_;
+        std::unordered_map<int, entry_t> handlers_;
+        std::vector<pid_t> orphans_;
+        int wake_read_{-1};
+        int wake_write_{-1};
+#if defined(__linux__)
+        int epoll_{-1};
+#endif
+    };
+}
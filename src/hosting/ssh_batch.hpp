@@ -0,0 +1,217 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <format>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace hosting::local
+{
+    // Coalesces the probes issued for the same host within a short window into one framed
+    // remote script, so a screen full of them costs a single channel round-trip. The first
+    // caller of a batch waits for the window to close and runs it; everybody else just
+    // waits for their own slice of the output. Probes run one after another under sh, so
+    // only short POSIX commands belong here; everything else takes its own channel.
+    struct ssh_batcher
+    {
+        struct result_t
+        {
+            std::string output;
+            int exit_code{0};
+        };
+
+        struct options_t
+        {
+            std::chrono::milliseconds window{15};
+            size_t max_commands{32};
+
+            // reads "batch-window-ms" and "batch-max-commands" from the "ssh" section of beatograph.json;
+            // a window of 0 disables batching
+            static options_t from_json(nlohmann::json const &node)
+            {
+                options_t result;
+                if (node.contains("batch-window-ms"))
+                {
+                    result.window = std::chrono::milliseconds{node.at("batch-window-ms").get<int>()};
+                }
+                if (node.contains("batch-max-commands"))
+                {
+                    result.max_commands = node.at("batch-max-commands").get<size_t>();
+                }
+                return result;
+            }
+        };
+
+        using runner_t = std::function<std::string(std::string_view host_name, std::string const &command, unsigned int timeout_seconds)>;
+
+        ssh_batcher(runner_t runner) : runner_{std::move(runner)} {}
+
+        void configure(options_t options)
+        {
+            std::lock_guard lock{mutex_};
+            options_ = options;
+        }
+
+        result_t run(std::string_view host_name, std::string const &command, unsigned int timeout_seconds = 5)
+        {
+            std::unique_lock lock{mutex_};
+            if (options_.window.count() <= 0 || options_.max_commands < 2)
+            {
+                lock.unlock();
+                return {runner_(host_name, command, timeout_seconds), 0};
+            }
+            std::string key{host_name};
+            auto &open = open_[key];
+            bool const leader{!open};
+            if (leader)
+            {
+                open = std::make_shared<batch_t>();
+            }
+            auto batch = open;
+            batch->commands.push_back(command);
+            auto future = batch->promises.emplace_back().get_future();
+            if (batch->commands.size() >= options_.max_commands)
+            {
+                open_.erase(key);
+                batch->cv.notify_all();
+            }
+            if (leader)
+            {
+                batch->cv.wait_for(lock, options_.window, [&] { return batch->commands.size() >= options_.max_commands; });
+                if (auto it = open_.find(key); it != open_.end() && it->second == batch)
+                {
+                    open_.erase(it);
+                }
+                lock.unlock();
+                execute(host_name, *batch, timeout_seconds);
+            }
+            else
+            {
+                lock.unlock();
+            }
+            return future.get();
+        }
+
+        static std::string quote(std::string_view text)
+        {
+            std::string result{"'"};
+            for (auto c : text)
+            {
+                if (c == '\'')
+                {
+                    result += "'\\''";
+                }
+                else
+                {
+                    result += c;
+                }
+            }
+            result += '\'';
+            return result;
+        }
+
+        // Every command runs in its own subshell with stdin/stderr detached, followed by
+        // a marker line carrying its index and exit status.
+        static std::string build_script(std::vector<std::string> const &commands, std::string_view marker)
+        {
+            std::string script;
+            for (size_t i = 0; i < commands.size(); ++i)
+            {
+                script += std::format("( {}\n) </dev/null 2>/dev/null; printf '\\n%s %d %d\\n' '{}' {} $?\n", commands[i], marker, i);
+            }
+            return std::format("sh -c {}", quote(script));
+        }
+
+        static std::vector<result_t> parse_output(std::string_view output, std::string_view marker, size_t count)
+        {
+            std::vector<result_t> results;
+            std::string const separator{std::format("\n{} ", marker)};
+            size_t pos{0};
+            while (results.size() < count)
+            {
+                auto const found = output.find(separator, pos);
+                if (found == std::string_view::npos)
+                {
+                    break;
+                }
+                auto const line_start = found + separator.size();
+                auto const line_end = output.find('\n', line_start);
+                if (line_end == std::string_view::npos)
+                {
+                    break;
+                }
+                // "<index> <exit code>"
+                auto const line = output.substr(line_start, line_end - line_start);
+                auto const space = line.find(' ');
+                if (space == std::string_view::npos || std::stoul(std::string{line.substr(0, space)}) != results.size())
+                {
+                    throw std::runtime_error(std::format("Malformed batch output near: {}", line));
+                }
+                results.push_back({std::string{output.substr(pos, found - pos)}, std::stoi(std::string{line.substr(space + 1)})});
+                pos = line_end + 1;
+            }
+            return results;
+        }
+
+    private:
+        struct batch_t
+        {
+            std::vector<std::string> commands;
+            std::vector<std::promise<result_t>> promises;
+            std::condition_variable cv;
+        };
+
+        static std::string new_marker()
+        {
+            thread_local std::mt19937_64 generator{std::random_device{}()};
+            return std::format("__beatograph_{:016x}__", generator());
+        }
+
+        void execute(std::string_view host_name, batch_t &batch, unsigned int timeout_seconds)
+        {
+            std::vector<result_t> results;
+            try
+            {
+                auto const marker{new_marker()};
+                auto const output{runner_(host_name, build_script(batch.commands, marker), timeout_seconds)};
+                results = parse_output(output, marker, batch.commands.size());
+            }
+            catch (...)
+            {
+                for (auto &promise : batch.promises)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+                return;
+            }
+            for (size_t i = 0; i < batch.promises.size(); ++i)
+            {
+                if (i < results.size())
+                {
+                    batch.promises[i].set_value(std::move(results[i]));
+                }
+                else
+                {
+                    batch.promises[i].set_exception(std::make_exception_ptr(
+                        std::runtime_error(std::format("Error: no output for batched command: {}", batch.commands[i]))));
+                }
+            }
+        }
+
+        runner_t runner_;
+        std::mutex mutex_;
+        options_t options_;
+        std::unordered_map<std::string, std::shared_ptr<batch_t>> open_;
+    };
+}
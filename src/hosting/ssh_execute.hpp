@@ -1,91 +1,458 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
 #include <format>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <libssh/libssh.h>
 #include <libssh/callbacks.h>
 
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+
+// One authenticated libssh session per host, shared by several concurrent channels.
+// libssh sessions are not thread safe, so every call into the session is serialized
+// by mutex_, but the lock is only held for each individual call and never across the
+// lifetime of a channel, nor while waiting for data; that lets several commands run on
+// the same connection.
 struct ssh_execute {
-    ssh_execute(std::string_view const &host_name, unsigned int timeout_seconds = 5) : host_name_{host_name} {
+    ssh_execute(std::string_view const &host_name, unsigned int timeout_seconds = 5, unsigned int max_channels = 4)
+        : host_name_{host_name}, timeout_seconds_{timeout_seconds}, max_channels_{max_channels == 0 ? 1 : max_channels} {
         ssh_init();
-        session = ssh_new();
-        if (session == nullptr) {
-            throw std::runtime_error("Error: could not create ssh session");
+        try {
+            std::lock_guard lock{mutex_};
+            connect();
         }
+        catch (...) {
+            disconnect();
+            ssh_finalize();
+            throw;
+        }
+    }
 
-        ssh_options_set(session, SSH_OPTIONS_HOST, host_name_.c_str());
-        ssh_options_set(session, SSH_OPTIONS_PORT_STR, "22");
-        // set the timeout
-        ssh_options_set(session, SSH_OPTIONS_TIMEOUT, &timeout_seconds);
+    ~ssh_execute() {
+        disconnect();
+        ssh_finalize();
+    }
 
-        int rc = ssh_connect(session);
-        if (rc != SSH_OK) {
-            throw std::runtime_error("Error: could not connect to ssh server");
+    // receives output as it arrives; returning false from the sink cancels the command
+    using chunk_sink_t = std::function<bool(std::string_view)>;
+
+    // Pooled channels count against max_channels. Dedicated ones are for the few streams that
+    // stay open for the life of the app, like docker events, which would otherwise keep one
+    // of the host's slots from the panels for good.
+    enum class channel_kind { pooled, dedicated };
+
+    std::string execute_command(std::string const &command)
+    {
+        std::string result;
+        execute_command(command, [&result](std::string_view chunk) {
+            result.append(chunk);
+            return true;
+        });
+        return result;
+    }
+
+    // Streams the output of command into sink. The read buffer starts small and doubles up
+    // to max_read_buffer while reads keep filling it; the channel is not read while the sink
+    // is busy, so a slow consumer applies backpressure through the ssh window. Reads never
+    // block under the session lock, waits for data happen outside it.
+    void execute_command(std::string const &command, chunk_sink_t sink, channel_kind kind = channel_kind::pooled)
+    {
+        channel_slot slot{*this, kind};
+        auto channel = open_channel([&command](ssh_channel ch) {
+            auto rc = ssh_channel_open_session(ch);
+            return rc == SSH_OK ? ssh_channel_request_exec(ch, command.c_str()) : rc;
+        });
+
+        std::vector<char> buffer(min_read_buffer);
+        for (;;) {
+            int nbytes;
+            {
+                std::lock_guard lock{mutex_};
+                if (!channel.valid()) {
+                    throw std::runtime_error("Error: ssh connection was reset");
+                }
+                nbytes = ssh_channel_read_nonblocking(channel.get(), buffer.data(), static_cast<uint32_t>(buffer.size()), 0);
+                if (nbytes == SSH_EOF || (nbytes == 0 && (ssh_channel_is_eof(channel.get()) || !ssh_channel_is_open(channel.get())))) {
+                    break;
+                }
+            }
+            if (nbytes == SSH_ERROR) {
+                throw std::runtime_error(std::format("Error: could not read from ssh channel: {}", last_error()));
+            }
+            if (nbytes > 0) {
+                if (!sink(std::string_view{buffer.data(), static_cast<size_t>(nbytes)})) {
+                    break;
+                }
+                if (static_cast<size_t>(nbytes) == buffer.size() && buffer.size() < max_read_buffer) {
+                    buffer.resize(buffer.size() * 2);
+                }
+            }
+            else {
+                wait_readable(read_slice_ms);
+            }
         }
-        connected = true;
+        touch();
+    }
 
-        // Authenticate using public key or password
-        rc = ssh_userauth_publickey_auto(session, NULL, NULL);
-        if (rc != SSH_AUTH_SUCCESS) {
-            throw std::runtime_error("Error: could not authenticate to ssh server");
+    // true while channels or tunnels are open on this session
+    bool busy() const {
+        return active_channels() > 0 || dedicated_channels_ > 0 || open_tunnels_ > 0;
+    }
+
+    // Sends an SSH_MSG_IGNORE so idle connections are not dropped by NAT or the server;
+    // returns false if the connection is gone, it will be reopened on next use.
+    bool keepalive() {
+        std::lock_guard lock{mutex_};
+        if (session_ == nullptr || !ssh_is_connected(session_)) {
+            return false;
         }
+        return ssh_send_ignore(session_, "keepalive") == SSH_OK;
     }
 
-    ~ssh_execute() {
-        if (session != nullptr) {
-            if (connected) {
-                ssh_disconnect(session);
-            }
-            ssh_free(session);
+    bool connected() const {
+        std::lock_guard lock{mutex_};
+        return session_ != nullptr && ssh_is_connected(session_);
+    }
+
+    std::chrono::steady_clock::time_point last_used() const {
+        return last_used_.load();
+    }
+
+    unsigned int active_channels() const {
+        std::lock_guard lock{slots_mutex_};
+        return active_channels_;
+    }
+
+    void set_max_channels(unsigned int max_channels) {
+        {
+            std::lock_guard lock{slots_mutex_};
+            max_channels_ = max_channels == 0 ? 1 : max_channels;
         }
-        ssh_finalize();
+        slots_cv_.notify_all();
     }
 
-    std::string execute_command(std::string const &command) 
-    {
-        ssh_channel channel;
-        std::lock_guard<std::mutex> lock(mutex);
-        channel = ssh_channel_new(session);
-        if (channel == nullptr) {
-            throw std::runtime_error("Error: could not create ssh channel");
+    std::string const &host_name() const { return host_name_; }
+
+    // the connection's socket, so an event loop can wake up when anything arrives on it
+    socket_t socket() const {
+        std::lock_guard lock{mutex_};
+        return session_ != nullptr ? ssh_get_fd(session_) : SSH_INVALID_SOCKET;
+    }
+
+private:
+    static constexpr int read_slice_ms{20};
+    static constexpr size_t min_read_buffer{4096};
+    static constexpr size_t max_read_buffer{65536};
+
+    // limits the number of channels that are open at the same time on this session;
+    // dedicated ones are only counted so the session is not closed under them
+    struct channel_slot {
+        channel_slot(ssh_execute &owner, channel_kind kind = channel_kind::pooled) : owner_{owner}, kind_{kind} {
+            if (kind_ == channel_kind::dedicated) {
+                ++owner_.dedicated_channels_;
+                return;
+            }
+            std::unique_lock lock{owner_.slots_mutex_};
+            owner_.slots_cv_.wait(lock, [this] { return owner_.active_channels_ < owner_.max_channels_; });
+            ++owner_.active_channels_;
         }
+        channel_slot(channel_slot const &) = delete;
+        ~channel_slot() {
+            if (kind_ == channel_kind::dedicated) {
+                --owner_.dedicated_channels_;
+            }
+            else {
+                {
+                    std::lock_guard lock{owner_.slots_mutex_};
+                    --owner_.active_channels_;
+                }
+                owner_.slots_cv_.notify_one();
+            }
+            owner_.touch();
+        }
+        // a slot if one is free right now, without waiting
+        static std::unique_ptr<channel_slot> try_acquire(ssh_execute &owner) {
+            {
+                std::lock_guard lock{owner.slots_mutex_};
+                if (owner.active_channels_ >= owner.max_channels_) {
+                    return nullptr;
+                }
+                ++owner.active_channels_;
+            }
+            return std::unique_ptr<channel_slot>{new channel_slot{owner, adopt_t{}}};
+        }
+    private:
+        struct adopt_t {};
+        channel_slot(ssh_execute &owner, adopt_t) : owner_{owner}, kind_{channel_kind::pooled} {}
+        ssh_execute &owner_;
+        channel_kind kind_;
+    };
 
-        auto rc = ssh_channel_open_session(channel);
-        if (rc != SSH_OK) {
-            // obtain the error description
-            const char *error_description = ssh_get_error(session);
+    // a channel bound to the session generation it was opened on; a reconnect frees
+    // every channel of the previous session, so stale handles must not be touched
+    struct channel_t {
+        channel_t(ssh_execute &owner, ssh_channel channel)
+            : owner_{owner}, channel_{channel}, generation_{owner.generation_} {}
+        channel_t(channel_t const &) = delete;
+        channel_t &operator=(channel_t const &) = delete;
+        ~channel_t() {
+            std::lock_guard lock{owner_.mutex_};
+            if (valid()) {
+                if (ssh_channel_is_open(channel_)) {
+                    ssh_channel_send_eof(channel_);
+                    ssh_channel_close(channel_);
+                }
+                ssh_channel_free(channel_);
+            }
+        }
+        // requires mutex_
+        bool valid() const { return generation_ == owner_.generation_; }
+        ssh_channel get() const { return channel_; }
+    private:
+        ssh_execute &owner_;
+        ssh_channel channel_;
+        unsigned long long generation_;
+    };
+
+public:
+    // A forwarded connection carried by a channel of this session; reads and write_some never
+    // block so a single event loop can pump many tunnels.
+    struct tunnel_t {
+        template <typename Opener>
+        tunnel_t(ssh_execute &owner, Opener opener, std::unique_ptr<channel_slot> slot = nullptr)
+            : owner_{owner}, slot_{std::move(slot)}, channel_{owner.open_channel(opener)} {
+            ++owner_.open_tunnels_;
+        }
+        ~tunnel_t() {
+            --owner_.open_tunnels_;
+        }
+
+        // returns the bytes read, 0 when nothing is pending, or -1 once the channel is closed
+        int read(char *buffer, size_t size) {
+            std::lock_guard lock{owner_.mutex_};
+            if (!channel_.valid()) {
+                return -1;
+            }
+            auto const nbytes = ssh_channel_read_nonblocking(channel_.get(), buffer, static_cast<uint32_t>(size), 0);
+            if (nbytes == SSH_ERROR || nbytes == SSH_EOF || (nbytes == 0 && (ssh_channel_is_eof(channel_.get()) || !ssh_channel_is_open(channel_.get())))) {
+                return -1;
+            }
+            if (nbytes > 0) {
+                owner_.touch();
+            }
+            return nbytes;
+        }
+
+        // waits up to timeout_ms for data without holding the session lock, so other
+        // channels keep flowing; returns the bytes read, 0 on timeout, or -1 once the
+        // channel is closed
+        int read(char *buffer, size_t size, int timeout_ms) {
+            auto const deadline {std::chrono::steady_clock::now() + std::chrono::milliseconds{timeout_ms}};
+            for (;;) {
+                if (auto const nbytes = read(buffer, size); nbytes != 0) {
+                    return nbytes;
+                }
+                auto const left {std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count()};
+                if (left <= 0) {
+                    return 0;
+                }
+                owner_.wait_readable(static_cast<int>(std::min<long long>(left, read_slice_ms)));
+            }
+        }
+
+        // writes as much as the remote window takes right now; returns the bytes written,
+        // 0 while the window is full, or -1 once the channel is closed
+        int write_some(std::string_view data) {
+            std::lock_guard lock{owner_.mutex_};
+            if (!channel_.valid() || !ssh_channel_is_open(channel_.get())) {
+                return -1;
+            }
+            auto const window = static_cast<size_t>(ssh_channel_window_size(channel_.get()));
+            auto const size = std::min(data.size(), window);
+            if (size == 0) {
+                return 0;
+            }
+            auto const written = ssh_channel_write(channel_.get(), data.data(), static_cast<uint32_t>(size));
+            if (written == SSH_ERROR) {
+                return -1;
+            }
+            owner_.touch();
+            return written;
+        }
+
+        // writes everything, waiting for the window in short slices so the session lock
+        // is never held while the server is slow to take data
+        bool write(std::string_view data) {
+            while (!data.empty()) {
+                auto const written = write_some(data);
+                if (written < 0) {
+                    return false;
+                }
+                if (written > 0) {
+                    data.remove_prefix(static_cast<size_t>(written));
+                    continue;
+                }
+                {
+                    // processes the window adjustments without taking this channel's data
+                    std::lock_guard lock{owner_.mutex_};
+                    if (!channel_.valid()) {
+                        return false;
+                    }
+                    ssh_channel_poll_timeout(channel_.get(), 0, 0);
+                }
+                owner_.wait_readable(read_slice_ms);
+            }
+            return true;
+        }
+
+    private:
+        ssh_execute &owner_;
+        // released after the channel is closed
+        std::unique_ptr<channel_slot> slot_;
+        channel_t channel_;
+    };
+
+    // Direct-tcpip channel to remote_host:remote_port as seen from the ssh server. It counts
+    // against max_channels like a command does; nullptr while they are all taken.
+    std::unique_ptr<tunnel_t> open_tunnel(std::string const &remote_host, int remote_port, int source_port) {
+        auto slot = channel_slot::try_acquire(*this);
+        if (!slot) {
+            return nullptr;
+        }
+        return std::make_unique<tunnel_t>(*this, [&remote_host, remote_port, source_port](ssh_channel ch) {
+            return ssh_channel_open_forward(ch, remote_host.c_str(), remote_port, "127.0.0.1", source_port);
+        }, std::move(slot));
+    }
+
+    // Streamlocal channel to a unix socket on the server, e.g. /var/run/docker.sock. A pooled
+    // one counts against max_channels too; its callers are worker threads, so it waits for a
+    // free slot like a command does.
+    std::unique_ptr<tunnel_t> open_unix_tunnel(std::string const &socket_path, channel_kind kind = channel_kind::pooled) {
+        auto slot = std::make_unique<channel_slot>(*this, kind);
+        return std::make_unique<tunnel_t>(*this, [&socket_path](ssh_channel ch) {
+            return ssh_channel_open_forward_unix(ch, socket_path.c_str(), "127.0.0.1", 0);
+        }, std::move(slot));
+    }
+
+private:
+    channel_t open_channel(std::function<int(ssh_channel)> opener) {
+        std::lock_guard lock{mutex_};
+        // reconnect transparently once if the server dropped us since the last use
+        for (int attempt = 0;; ++attempt) {
+            if (session_ == nullptr || !ssh_is_connected(session_)) {
+                connect();
+            }
+            ssh_channel channel = ssh_channel_new(session_);
+            if (channel == nullptr) {
+                throw std::runtime_error("Error: could not create ssh channel");
+            }
+            if (opener(channel) == SSH_OK) {
+                return channel_t{*this, channel};
+            }
+            std::string error_description{ssh_get_error(session_)};
             ssh_channel_close(channel);
             ssh_channel_free(channel);
-            throw std::runtime_error(std::format("Error: could not open ssh channel: {}", error_description));
+            if (attempt > 0 || ssh_is_connected(session_)) {
+                throw std::runtime_error(std::format("Error: could not open ssh channel: {}", error_description));
+            }
+        }
+    }
+
+    // Waits, without the session lock, until the socket has something to read or timeout_ms
+    // pass. Data for a channel may already sit in libssh's buffers, taken off the socket by
+    // another channel's read, so callers wait in short slices and then look for themselves.
+    void wait_readable(int timeout_ms) const {
+        auto const fd {socket()};
+        if (fd == SSH_INVALID_SOCKET) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{timeout_ms});
+            return;
+        }
+        // a reconnect in between closes fd, which only makes poll return early
+#if defined(_WIN32)
+        WSAPOLLFD pfd{fd, POLLRDNORM, 0};
+        ::WSAPoll(&pfd, 1, timeout_ms);
+#else
+        ::pollfd pfd{fd, POLLIN, 0};
+        ::poll(&pfd, 1, timeout_ms);
+#endif
+    }
+
+    // requires mutex_
+    void connect() {
+        disconnect_locked();
+        session_ = ssh_new();
+        if (session_ == nullptr) {
+            throw std::runtime_error("Error: could not create ssh session");
         }
 
-        rc = ssh_channel_request_exec(channel, command.c_str());
+        ssh_options_set(session_, SSH_OPTIONS_HOST, host_name_.c_str());
+        ssh_options_set(session_, SSH_OPTIONS_PORT_STR, "22");
+        // set the timeout
+        ssh_options_set(session_, SSH_OPTIONS_TIMEOUT, &timeout_seconds_);
+
+        int rc = ssh_connect(session_);
         if (rc != SSH_OK) {
-            const char *error_description = ssh_get_error(session);
-            ssh_channel_close(channel);
-            ssh_channel_free(channel);
-            throw std::runtime_error(std::format("Error: could not execute command: {}", error_description));
+            throw std::runtime_error("Error: could not connect to ssh server");
         }
+        connected_ = true;
 
-        std::string result;
-        char buffer[256];
-        int nbytes;
-        while ((nbytes = ssh_channel_read(channel, buffer, sizeof(buffer), 0)) > 0) {
-            result.append(buffer, nbytes);
+        // Authenticate using public key or password
+        rc = ssh_userauth_publickey_auto(session_, NULL, NULL);
+        if (rc != SSH_AUTH_SUCCESS) {
+            throw std::runtime_error("Error: could not authenticate to ssh server");
         }
+        touch();
+    }
 
-        ssh_channel_send_eof(channel);
-        ssh_channel_close(channel);
-        ssh_channel_free(channel);
+    void disconnect() {
+        std::lock_guard lock{mutex_};
+        disconnect_locked();
+    }
 
-        return result;
+    void disconnect_locked() {
+        if (session_ != nullptr) {
+            if (connected_) {
+                ssh_disconnect(session_);
+            }
+            ssh_free(session_);
+            session_ = nullptr;
+            ++generation_;
+        }
+        connected_ = false;
+    }
+
+    std::string last_error() {
+        std::lock_guard lock{mutex_};
+        return session_ ? ssh_get_error(session_) : "not connected";
+    }
+
+    void touch() {
+        last_used_.store(std::chrono::steady_clock::now());
     }
 
-private:
     std::string host_name_;
-    ssh_session session{nullptr};
-    bool connected{false};
-    std::mutex mutex;
+    unsigned int timeout_seconds_;
+    ssh_session session_{nullptr};
+    bool connected_{false};
+    unsigned long long generation_{0};
+    mutable std::mutex mutex_;
+    mutable std::mutex slots_mutex_;
+    std::condition_variable slots_cv_;
+    unsigned int max_channels_;
+    unsigned int active_channels_{0};
+    std::atomic<unsigned int> dedicated_channels_{0};
+    std::atomic<unsigned int> open_tunnels_{0};
+    std::atomic<std::chrono::steady_clock::time_point> last_used_{std::chrono::steady_clock::now()};
 };
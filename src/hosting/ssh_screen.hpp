@@ -135,7 +135,7 @@ namespace hosting::ssh
                     std::string description;
                 };
                 views::cached_view<std::vector<unit>>("SystemCtl Units", [hostname = host->name(), localhost]() {
-                    auto const result {localhost->ssh("sudo systemctl list-units", hostname)};
+                    auto const result {localhost->ssh_probe("sudo systemctl list-units", hostname)};
                     std::vector<unit> units;
                     for (auto const &line : std::string_view{result} | std::views::split('\n') | std::views::drop(1))
                     {
@@ -229,7 +229,7 @@ namespace hosting::ssh
                 };
 
                 views::cached_view<std::vector<process>>("Processes", [hostname = host->name(), localhost]() {
-                    auto const result {localhost->ssh("ps aux", hostname)};
+                    auto const result {localhost->ssh_probe("ps aux", hostname)};
                     std::vector<process> processes;
                     for (auto const &line : std::string_view{result} | std::views::split('\n') | std::views::drop(1))
                     {
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "ssh_execute.hpp"
+
+namespace hosting::local
+{
+    // Keeps one multiplexed ssh_execute per host alive between commands, sends keepalives
+    // on idle connections and closes the ones nobody used for a while.
+    struct ssh_sessions
+    {
+        struct options_t
+        {
+            unsigned int max_channels{4};
+            std::unordered_map<std::string, unsigned int> max_channels_by_host;
+            std::chrono::seconds keepalive_interval{30};
+            std::chrono::seconds idle_timeout{300};
+
+            // reads the "ssh" section of beatograph.json, e.g.
+            // {"max-channels": 4, "keepalive-seconds": 30, "idle-seconds": 300, "hosts": {"name": {"max-channels": 8}}}
+            static options_t from_json(nlohmann::json const &node)
+            {
+                options_t result;
+                if (node.contains("max-channels"))
+                {
+                    result.max_channels = node.at("max-channels").get<unsigned int>();
+                }
+                if (node.contains("keepalive-seconds"))
+                {
+                    result.keepalive_interval = std::chrono::seconds{node.at("keepalive-seconds").get<int>()};
+                }
+                if (node.contains("idle-seconds"))
+                {
+                    result.idle_timeout = std::chrono::seconds{node.at("idle-seconds").get<int>()};
+                }
+                if (node.contains("hosts"))
+                {
+                    for (auto const &[name, host] : node.at("hosts").items())
+                    {
+                        if (host.contains("max-channels"))
+                        {
+                            result.max_channels_by_host[name] = host.at("max-channels").get<unsigned int>();
+                        }
+                    }
+                }
+                return result;
+            }
+
+            unsigned int channels_for(std::string const &host_name) const
+            {
+                auto it = max_channels_by_host.find(host_name);
+                return it == max_channels_by_host.end() ? max_channels : it->second;
+            }
+        };
+
+        ssh_sessions() = default;
+        ssh_sessions(ssh_sessions const &) = delete;
+
+        ~ssh_sessions()
+        {
+            reaper_.request_stop();
+            cv_.notify_all();
+        }
+
+        void configure(options_t options)
+        {
+            std::lock_guard lock{mutex_};
+            options_ = std::move(options);
+            for (auto &[name, session] : sessions_)
+            {
+                session->set_max_channels(options_.channels_for(name));
+            }
+            cv_.notify_all();
+        }
+
+        std::shared_ptr<ssh_execute> get(std::string_view host_name, unsigned int timeout_seconds = 5)
+        {
+            std::string key{host_name};
+            std::promise<std::shared_ptr<ssh_execute>> promise;
+            std::shared_future<std::shared_ptr<ssh_execute>> pending;
+            unsigned int max_channels{};
+            {
+                std::lock_guard lock{mutex_};
+                if (auto it = sessions_.find(key); it != sessions_.end())
+                {
+                    return it->second;
+                }
+                if (auto it = connecting_.find(key); it != connecting_.end())
+                {
+                    pending = it->second;
+                }
+                else
+                {
+                    connecting_.emplace(key, promise.get_future().share());
+                    max_channels = options_.channels_for(key);
+                }
+            }
+            if (pending.valid())
+            {
+                // somebody else is already connecting to this host, share their session
+                return pending.get();
+            }
+            // connecting can take seconds, don't block the other hosts meanwhile
+            std::shared_ptr<ssh_execute> session;
+            try
+            {
+                session = std::make_shared<ssh_execute>(key, timeout_seconds, max_channels);
+            }
+            catch (...)
+            {
+                {
+                    std::lock_guard lock{mutex_};
+                    connecting_.erase(key);
+                }
+                promise.set_exception(std::current_exception());
+                throw;
+            }
+            {
+                std::lock_guard lock{mutex_};
+                connecting_.erase(key);
+                sessions_.emplace(key, session);
+                if (!reaper_.joinable())
+                {
+                    reaper_ = std::jthread{[this](std::stop_token stop) { reap(stop); }};
+                }
+            }
+            promise.set_value(session);
+            return session;
+        }
+
+        void recycle(std::string_view host_name)
+        {
+            // any command still running keeps its own reference to the session
+            std::shared_ptr<ssh_execute> session;
+            {
+                std::lock_guard lock{mutex_};
+                if (auto it = sessions_.find(std::string{host_name}); it != sessions_.end())
+                {
+                    session = std::move(it->second);
+                    sessions_.erase(it);
+                }
+            }
+        }
+
+        bool has(std::string_view host_name) const
+        {
+            std::lock_guard lock{mutex_};
+            return sessions_.contains(std::string{host_name});
+        }
+
+    private:
+        void reap(std::stop_token stop)
+        {
+            std::unique_lock lock{mutex_};
+            while (!stop.stop_requested())
+            {
+                // a zero keepalive or idle setting must not turn this into a busy loop
+                auto const interval = std::max(std::chrono::seconds{1}, std::min(options_.keepalive_interval, options_.idle_timeout));
+                cv_.wait_for(lock, stop, interval, [] { return false; });
+                if (stop.stop_requested())
+                {
+                    break;
+                }
+                auto const now = std::chrono::steady_clock::now();
+                std::vector<std::shared_ptr<ssh_execute>> reaped;
+                std::vector<std::shared_ptr<ssh_execute>> to_ping;
+                for (auto it = sessions_.begin(); it != sessions_.end();)
+                {
+                    auto const idle = now - it->second->last_used();
+                    if (idle > options_.idle_timeout && !it->second->busy())
+                    {
+                        reaped.push_back(std::move(it->second));
+                        it = sessions_.erase(it);
+                        continue;
+                    }
+                    if (idle > options_.keepalive_interval)
+                    {
+                        to_ping.push_back(it->second);
+                    }
+                    ++it;
+                }
+                // disconnecting and pinging talk to the network, do it without holding the map
+                lock.unlock();
+                reaped.clear();
+                for (auto const &session : to_ping)
+                {
+                    if (!session->keepalive())
+                    {
+                        std::cerr << "ssh keepalive failed for " << session->host_name() << ", will reconnect on next use\n";
+                    }
+                }
+                lock.lock();
+            }
+        }
+
+        mutable std::mutex mutex_;
+        std::condition_variable_any cv_;
+        options_t options_;
+        std::unordered_map<std::string, std::shared_ptr<ssh_execute>> sessions_;
+        std::unordered_map<std::string, std::shared_future<std::shared_ptr<ssh_execute>>> connecting_;
+        std::jthread reaper_;
+    };
+}
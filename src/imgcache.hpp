@@ -1,11 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <mutex>
+#include <set>
+#include <optional>
 #include <string>
 #include <thread>
 
@@ -22,6 +25,7 @@ extern "C"
 #endif
 
 #include "hosting/http/fetch.hpp"
+#include "util/hashing/sha256.hpp"
 
 struct img_cache
 {
@@ -46,6 +50,7 @@ struct img_cache
                 }
             }
         }
+        collect_garbage();
     }
     ~img_cache()
     {
@@ -69,10 +74,99 @@ struct img_cache
         }
     }
 
+    // Files are named by their digest alone. Entries still pointing at older names
+    // (std::hash of the url, or digest plus extension) are renamed, entries whose file
+    // is gone are dropped, and any file the index no longer references is deleted.
+    void collect_garbage()
+    {
+        std::lock_guard lock{index_mutex_};
+        std::map<std::string, std::string> renamed;
+        for (auto it = index_.begin(); it != index_.end();)
+        {
+            std::filesystem::path const path{it->second};
+            std::error_code ec;
+            if (!std::filesystem::is_regular_file(path, ec))
+            {
+                it = index_.erase(it);
+                continue;
+            }
+            if (!is_digest(path.filename().string()))
+            {
+                auto &target = renamed[it->second];
+                if (target.empty())
+                {
+                    target = (cache_path_ / digest_of(path)).string();
+                    if (std::filesystem::exists(target))
+                    {
+                        std::filesystem::remove(path, ec);
+                    }
+                    else
+                    {
+                        std::filesystem::rename(path, target, ec);
+                    }
+                }
+                it->second = target;
+            }
+            ++it;
+        }
+        std::set<std::filesystem::path> referenced;
+        for (auto const &[url, file] : index_)
+        {
+            referenced.insert(std::filesystem::path{file}.filename());
+        }
+        for (auto const &entry : std::filesystem::directory_iterator{cache_path_})
+        {
+            auto const name = entry.path().filename();
+            if (entry.is_regular_file() && name != "index.txt" && !referenced.contains(name))
+            {
+                std::error_code ec;
+                std::filesystem::remove(entry.path(), ec);
+            }
+        }
+    }
+
+    static bool is_digest(std::string_view name)
+    {
+        return name.size() == 64 && name.find_first_not_of("0123456789abcdef") == std::string_view::npos;
+    }
+
+    static std::string digest_of(std::filesystem::path const &path)
+    {
+        hashing::sha256 hash;
+        std::ifstream file{path, std::ios::binary};
+        char buffer[64 * 1024];
+        while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+        {
+            hash.update(buffer, static_cast<size_t>(file.gcount()));
+        }
+        return hash.hex_digest();
+    }
+
+#if defined (SUPPORT_SVG)
+    // cached files carry no extension, so svg is told apart by its contents
+    static bool is_svg(std::string const &file_path)
+    {
+        std::ifstream file{file_path, std::ios::binary};
+        std::string head(512, '\0');
+        file.read(head.data(), head.size());
+        head.resize(static_cast<size_t>(file.gcount()));
+        return head.find("<svg") != std::string::npos;
+    }
+#endif // SUPPORT_SVG
+
+    // downloads are hashed while they are written, so the content key is known
+    // as soon as the transfer ends without reading the file back
+    struct download_t
+    {
+        std::ofstream file;
+        hashing::sha256 hash;
+    };
+
     static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp)
     {
-        auto image_file = static_cast<std::ofstream *>(userp);
-        image_file->write(static_cast<char *>(contents), size * nmemb);
+        auto download = static_cast<download_t *>(userp);
+        download->file.write(static_cast<char *>(contents), size * nmemb);
+        download->hash.update(contents, size * nmemb);
         return size * nmemb;
     }
 
@@ -84,7 +178,7 @@ struct img_cache
         }
         SDL_Surface *surface = nullptr;
 #if defined (SUPPORT_SVG)
-        if (file_path.ends_with(".SVG") || file_path.ends_with(".svg"))
+        if (is_svg(file_path))
         {
             // Initialize librsvg
             RsvgHandle *handle = rsvg_handle_new_from_file(file_path.c_str(), nullptr);
@@ -152,7 +246,6 @@ struct img_cache
 
     long long load_texture_from_url(std::string const &url, 
         http::fetch::header_client_t header_client = {}, 
-        std::string const &default_extension = ".png",
         std::optional<std::chrono::minutes> max_age = std::nullopt)
     {
         std::lock_guard lock{index_mutex_};
@@ -167,11 +260,11 @@ struct img_cache
         {
             // create one
             loader_threads_[url] = std::jthread{
-                [this, url, header_client, default_extension, max_age]
+                [this, url, header_client, max_age]
                 {
                     try
                     {
-                        load_into_cache(url, header_client, default_extension, max_age);
+                        load_into_cache(url, header_client, max_age);
                     }
                     catch (std::exception const &e)
                     {
@@ -188,52 +281,72 @@ struct img_cache
         return load_texture_from_file("assets/b6a9d081425dd6a.png");
     }
 
-    void load_into_cache(std::string const &url, http::fetch::header_client_t header_client, std::string_view default_extension, std::optional<std::chrono::minutes> max_age)
+    void load_into_cache(std::string const &url, http::fetch::header_client_t header_client, std::optional<std::chrono::minutes> max_age)
     {
-        // obtain the url path plus filename part only (exclude querystring or hash)
-        auto const pos_qs = url.find('?');
-        auto const pos_hash = url.find('#');
-        auto const pos_end = pos_qs < pos_hash ? pos_qs : pos_hash;
-        auto const url_path = url.substr(0, pos_end);
-
-        // get the url extension
-        auto pos = url_path.find_last_of('.');
-        std::string extension;
-        if (pos != std::string::npos)
+        // files are named after their contents alone, so identical images served from
+        // different urls, or with different extensions, are stored only once; the index
+        // maps each url to its file
+        std::optional<std::filesystem::path> known_path;
         {
-            extension = url_path.substr(pos);
+            std::lock_guard lock{index_mutex_};
+            if (auto it = index_.find(url); it != index_.end())
+            {
+                known_path = it->second;
+            }
         }
-        if (extension.size() > 5)
+        if (known_path && std::filesystem::exists(*known_path) &&
+            (!max_age.has_value() || std::filesystem::last_write_time(*known_path) >= std::filesystem::file_time_type::clock::now() - *max_age))
         {
-            extension.clear();
+            return;
         }
-        if (extension.empty())
+
+        auto const temp_path = cache_path_ / std::format("download-{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        std::string digest;
+        try {
+            http::fetch fetcher;
+            download_t download{std::ofstream{temp_path, std::ios::binary}};
+            fetcher(url, header_client, write_callback, &download);
+            download.file.close();
+            digest = download.hash.hex_digest();
+        }
+        catch (std::exception const &)
         {
-            extension = default_extension;
+            std::filesystem::remove(temp_path);
+            throw;
         }
-        // make the extension uppercase
-        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
-                       { return std::toupper(c); });
-        auto file_path = cache_path_ / std::format("{}{}", std::hash<std::string>{}(url), extension);
 
-        if (!std::filesystem::exists(file_path) || 
-            (max_age.has_value() && std::filesystem::last_write_time(file_path) < std::filesystem::file_time_type::clock::now() - *max_age))
+        auto const file_path = cache_path_ / digest;
+        if (std::filesystem::exists(file_path))
         {
-            // download the image into file_path
-            try {
-                http::fetch fetcher;
-                std::ofstream image_file{file_path, std::ios::binary};
-                fetcher(url, header_client, write_callback, &image_file);
-            }
-            catch (std::exception const &)
+            // same bytes already stored under another url; refresh its age instead
+            std::filesystem::remove(temp_path);
+            std::filesystem::last_write_time(file_path, std::filesystem::file_time_type::clock::now());
+        }
+        else if (std::error_code ec; std::filesystem::rename(temp_path, file_path, ec), ec)
+        {
+            // another download may have produced the same file in the meantime
+            std::filesystem::remove(temp_path);
+            if (!std::filesystem::exists(file_path))
             {
-                std::filesystem::remove(file_path);
-                throw;
+                throw std::filesystem::filesystem_error("Failed to store image", temp_path, file_path, ec);
             }
         }
+        std::optional<std::string> replaced;
         {
             std::lock_guard lock{index_mutex_};
-            index_[url] = file_path.string();
+            auto &entry = index_[url];
+            if (!entry.empty() && entry != file_path.string() &&
+                std::none_of(index_.begin(), index_.end(), [&](auto const &other) { return &other.second != &entry && other.second == entry; }))
+            {
+                replaced = entry;
+            }
+            entry = file_path.string();
+        }
+        if (replaced)
+        {
+            // the url's content changed and nothing else points at the old bytes
+            std::error_code ec;
+            std::filesystem::remove(*replaced, ec);
         }
     }
 
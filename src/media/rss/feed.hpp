@@ -1,17 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <format>
 #include <functional>
+#include <iterator>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <set>
 #include <sstream>
 #include <string>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
-#include <tinyxml2.h>
-#include "../../hosting/http/fetch.hpp"
-#include "../../registrar.hpp"
+#include "xml_stream.hpp"
 
 namespace media::rss {
     struct feed {
@@ -23,7 +28,11 @@ namespace media::rss {
             std::string description;
             std::string enclosure;
             std::string image_url;
+            // <guid> or <id>, when the feed gives one
+            std::string guid;
             std::chrono::system_clock::time_point updated;
+            // false for items paged in from the database, whose description is read on demand
+            bool description_loaded{true};
 
             item() = default;
             item(std::string_view title, std::string_view link, std::string_view description,
@@ -31,44 +40,17 @@ namespace media::rss {
                  std::chrono::system_clock::time_point updated)
                 : title(title), link(link), description(description),
                   enclosure(enclosure), image_url(image_url), updated(updated) {}
+        };
+        using items_t = std::vector<item>;
 
-            void refresh_summary() noexcept {
-                try {
-                    auto const link_contents = http::fetch{}(link);
-                    auto const summarize = registrar::get<std::function<std::string(std::string_view)>>({});
-                    auto text = (*summarize)(link_contents);
-                    summary_ = text;
-                }
-                catch (std::exception const &e) {
-                    summary_ = e.what();
-                }
-                catch (...) {
-                    summary_ = "Failed to summarize";
-                }
-            }
-            [[nodiscard]] std::string_view summary() noexcept {
-                if (summary_.empty()) {
-                    refresh_summary();
-                }
-                return summary_;
-            }
-        private:
-            std::string summary_;
+        // the last stored item loaded, where the next page starts
+        struct page_cursor_t {
+            long long pub_ts;
+            std::string link;
         };
 
         feed(std::function<std::string(std::string_view)> system_runner) : system_runner_(system_runner) {}
-
-        void operator()(std::string_view partial_contents) {
-            contents += partial_contents;
-            tinyxml2::XMLDocument doc;
-            doc.Parse(contents.c_str());
-            if (doc.Error()) {
-                // the document might be incomplete, so we ignore the error
-            }
-            else {
-                (*this)(doc);
-            }
-        }
+        feed(feed const &) = delete;
 
         static std::mutex &image_mutex() {
             static std::mutex mx;
@@ -88,163 +70,268 @@ namespace media::rss {
             return feed_image_url;
         }
 
-        void operator()(tinyxml2::XMLDocument const &doc) {
-            if (auto root = doc.FirstChildElement("rss"); root) {
-                auto channel = root->FirstChildElement("channel");
-                if (channel) {
-                    auto title = channel->FirstChildElement("title");
-                    if (title) {
-                        feed_title = title->GetText();
-                    }
-                    auto link = channel->FirstChildElement("link");
-                    if (link) {
-                        feed_link = link->GetText();
-                    }
-                    auto description = channel->FirstChildElement("description");
-                    if (description) {
-                        feed_description = description->GetText();
-                    }
-                    auto image = channel->FirstChildElement("image");
-                    if (image) {
-                        auto url = image->FirstChildElement("url");
-                        if (url) {
-                            set_image(url->GetText());
-                        }
-                    }
-                    else {
-                        auto itunes_image = channel->FirstChildElement("itunes:image");
-                        if (itunes_image) {
-                            set_image(itunes_image->Attribute("href"));
-                        }
-                    }
-                    for (
-                        auto xml_item = channel->FirstChildElement("item");
-                        xml_item;
-                        xml_item = xml_item->NextSiblingElement("item")) 
-                    {
-                        item new_item;
-                        title = xml_item->FirstChildElement("title");
-                        if (title) {
-                            new_item.title = title->GetText();
-                        }
-                        link = xml_item->FirstChildElement("link");
-                        if (link) {
-                            new_item.link = link->GetText();
-                        }
-                        description = xml_item->FirstChildElement("description");
-                        if (description && !description->NoChildren()) {
-                            new_item.description = description->GetText();
-                        }
-                        auto enclosure = xml_item->FirstChildElement("enclosure");
-                        if (enclosure) {
-                            new_item.enclosure = enclosure->Attribute("url");
-                        }
-                        // if there is no direct enclosure, we can try to get one if the link is to youtube
-                        else if (new_item.link.find("youtube.com") != std::string::npos) {
-                            new_item.enclosure = new_item.link;
-                        }
-                        // look for an itunes:image tag
-                        auto itunes_image = xml_item->FirstChildElement("itunes:image");
-                        if (itunes_image) {
-                            new_item.image_url = itunes_image->Attribute("href");
-                        }
-                        // obtain the updated time from a tag similar to
-                        // <pubDate>Tue, 14 Apr 2020 18:16:11 +0000</pubDate>
-                        if (auto pub_date = xml_item->FirstChildElement("pubDate"); pub_date) {
-                            std::istringstream pub_date_istr{pub_date->GetText()};
-                            pub_date_istr >> std::chrono::parse("%a, %d %b %Y %T %z", new_item.updated);
-                        }
-                        items.emplace_back(std::move(new_item));
-                    }
+        // title and description of a feed already on screen, which a refresh may change
+        void set_details(std::string title, std::string description) {
+            std::lock_guard lock{details_mutex_};
+            feed_title = std::move(title);
+            feed_description = std::move(description);
+        }
+
+        std::pair<std::string, std::string> details() const {
+            std::lock_guard lock{details_mutex_};
+            return {feed_title, feed_description};
+        }
+
+        // The items, newest first. Each change publishes a new list, so a reader keeps a
+        // consistent one for as long as it holds the pointer.
+        std::shared_ptr<items_t const> items() const {
+            return items_.load();
+        }
+
+        static bool newer_first(item const &lhs, item const &rhs) {
+            return lhs.updated > rhs.updated;
+        }
+
+        // whether an item with the same link or guid is already here; writers only
+        bool knows(item const &candidate) const {
+            return (!candidate.link.empty() && item_keys_.contains(candidate.link))
+                || (!candidate.guid.empty() && item_keys_.contains(candidate.guid));
+        }
+
+        // Adds the items not seen before, keeping items newest first with one pass over the
+        // existing ones, and publishes the result; returns the added items. Writers must be
+        // serialized by the caller, readers never wait.
+        items_t merge_items(items_t incoming) {
+            std::vector<item> fresh;
+            for (auto &candidate : incoming) {
+                if (!knows(candidate)) {
+                    index(candidate);
+                    fresh.emplace_back(std::move(candidate));
                 }
             }
-            else if (auto root_feed = doc.FirstChildElement("feed"); root_feed) {
-                auto title = root_feed->FirstChildElement("title");
-                if (title) {
-                    feed_title = title->GetText();
-                }
-                auto link = root_feed->FirstChildElement("link");
-                if (link) {
-                    feed_link = link->Attribute("href");
+            if (fresh.empty()) {
+                return fresh;
+            }
+            std::stable_sort(fresh.begin(), fresh.end(), newer_first);
+            auto const current = items_.load();
+            auto merged = std::make_shared<items_t>();
+            merged->reserve(current->size() + fresh.size());
+            std::merge(current->begin(), current->end(), fresh.begin(), fresh.end(), std::back_inserter(*merged), newer_first);
+            items_.store(std::move(merged));
+            return fresh;
+        }
+
+        // when the newest item was published, loaded or not, for ordering the feeds
+        std::chrono::system_clock::time_point latest() const {
+            auto const current = items_.load();
+            return current->empty() ? stored_latest : std::max(stored_latest, current->front().updated);
+        }
+
+        // fixed once the feed is published
+        std::string source_link;
+        std::string feed_link;
+        // filled by the reader; use details() once the feed is published
+        std::string feed_title;
+        std::string feed_description;
+        std::function<std::string(std::string_view)> system_runner_;
+        std::atomic<long long> repo_id{-1};
+        // items stay in the database until the feed is opened, then come a page at a time;
+        // the cursor belongs to whoever loads the pages
+        std::optional<page_cursor_t> page_cursor;
+        std::atomic<bool> all_pages_loaded{false};
+        std::chrono::system_clock::time_point stored_latest{std::chrono::system_clock::time_point::min()};
+        std::set<std::string> tags;
+
+    private:
+        void index(item const &added) {
+            if (!added.link.empty()) item_keys_.insert(added.link);
+            if (!added.guid.empty()) item_keys_.insert(added.guid);
+        }
+
+        std::string feed_image_url;
+        mutable std::mutex details_mutex_;
+        std::atomic<std::shared_ptr<items_t const>> items_{std::make_shared<items_t const>()};
+        std::unordered_set<std::string> item_keys_;
+    };
+
+    // Fills a feed's details, and a list of its items, from an RSS 2.0 or Atom document as
+    // it downloads. Each item is added when its closing tag arrives; once a run of items is
+    // already known (feeds list the newest first) the rest of the document is not needed
+    // and stopped() turns true.
+    struct feed_reader {
+        using known_t = std::function<bool(feed::item const &candidate)>;
+        // a few known items in a row, so a pinned old episode on top does not end the read
+        static constexpr int known_streak_limit {3};
+
+        feed_reader(feed &target, feed::items_t &items, known_t known = {})
+            : target_{target}, items_{items}, known_{std::move(known)},
+              xml_{{
+                  [this](std::string_view name, xml_stream::attributes_t const &attributes) { open(name, attributes); },
+                  [this](std::string_view name) { close(name); },
+                  [this](std::string_view text) { if (capture_ && path_.size() == capture_depth_) *capture_ += text; }
+              }} {}
+
+        feed_reader(feed_reader const &) = delete;
+
+        void operator()(std::string_view chunk) {
+            if (!stopped_) {
+                xml_(chunk);
+            }
+        }
+
+        bool stopped() const { return stopped_; }
+
+    private:
+        void open(std::string_view name, xml_stream::attributes_t const &attributes) {
+            path_.emplace_back(name);
+            auto const depth {path_.size()};
+            if (depth == 1) {
+                atom_ = name == "feed";
+                return;
+            }
+            auto const parent = std::string_view{path_[depth - 2]};
+            auto const attribute = [&attributes](std::string_view key) { return xml_stream::attribute(attributes, key); };
+            // <rss><channel>... and <feed>... hold the same things one level apart
+            auto const feed_depth {atom_ ? 2u : 3u};
+            if (!in_item_) {
+                if (depth == feed_depth && (name == "item" || name == "entry")) {
+                    in_item_ = true;
+                    item_ = {};
+                    item_link_set_ = false;
+                    item_date_.clear();
+                    summary_seen_ = false;
                 }
-                auto description = root_feed->FirstChildElement("description");
-                if (description) {
-                    feed_description = description->GetText();
+                else if (depth == feed_depth && !atom_ && parent != "channel") {
+                    return;
                 }
-                auto image = root_feed->FirstChildElement("image");
-                if (image) {
-                    auto url = image->FirstChildElement("url");
-                    if (url) {
-                        set_image(url->GetText());
+                else if (depth == feed_depth) {
+                    if (name == "title" && !title_seen_) { title_seen_ = true; target_.feed_title.clear(); start_capture(target_.feed_title); }
+                    else if (name == "link" && !link_seen_) {
+                        link_seen_ = true;
+                        target_.feed_link = atom_ ? std::string{attribute("href")} : std::string{};
+                        if (!atom_) start_capture(target_.feed_link);
                     }
+                    else if (name == "description" && !description_seen_) { description_seen_ = true; target_.feed_description.clear(); start_capture(target_.feed_description); }
+                    else if (name == "itunes:image") offer_image(2, attribute("href"));
+                    else if (atom_ && name == "media:thumbnail") offer_image(3, attribute("url"));
+                    else if (atom_ && name == "icon") { image_text_.clear(); image_text_priority_ = 4; start_capture(image_text_); }
                 }
-                else if (auto itunes_image = root_feed->FirstChildElement("itunes:image"); itunes_image) {
-                    set_image(itunes_image->Attribute("href"));
+                else if (depth == feed_depth + 1 && parent == "image" && name == "url") {
+                    image_text_.clear();
+                    image_text_priority_ = 1;
+                    start_capture(image_text_);
                 }
-                else if (auto image_el = root_feed->FirstChildElement("media:thumbnail"); image_el) {
-                    set_image(image_el->Attribute("url"));
+                return;
+            }
+            auto const item_depth {feed_depth + 1};
+            if (depth == item_depth) {
+                if (name == "title" && item_.title.empty()) start_capture(item_.title);
+                else if (name == "link" && !item_link_set_) {
+                    item_link_set_ = true;
+                    if (atom_) item_.link = attribute("href");
+                    else start_capture(item_.link);
                 }
-                else if (auto icon_el = root_feed->FirstChildElement("icon"); icon_el) {
-                    set_image(icon_el->GetText());
+                else if (!atom_ && name == "description" && item_.description.empty()) start_capture(item_.description);
+                else if (atom_ && name == "summary") { summary_seen_ = true; item_.description.clear(); start_capture(item_.description); }
+                else if (atom_ && name == "content" && !summary_seen_ && item_.description.empty()) start_capture(item_.description);
+                else if (!atom_ && name == "enclosure" && item_.enclosure.empty()) item_.enclosure = attribute("url");
+                else if (!atom_ && name == "itunes:image" && item_.image_url.empty()) item_.image_url = attribute("href");
+                else if ((atom_ ? name == "updated" : name == "pubDate") && item_date_.empty()) start_capture(item_date_);
+                else if ((atom_ ? name == "id" : name == "guid") && item_.guid.empty()) start_capture(item_.guid);
+            }
+            else if (atom_ && depth == item_depth + 1 && parent == "media:group") {
+                if (name == "media:content" && item_.enclosure.empty()) item_.enclosure = attribute("url");
+                else if (name == "media:thumbnail" && item_.image_url.empty()) item_.image_url = attribute("url");
+            }
+        }
+
+        void close(std::string_view) {
+            if (path_.empty()) {
+                return;
+            }
+            auto const depth {path_.size()};
+            if (capture_ && depth == capture_depth_) {
+                trim(*capture_);
+                if (capture_ == &image_text_) {
+                    offer_image(image_text_priority_, image_text_);
                 }
-                
-                for (
-                    auto xml_item = root_feed->FirstChildElement("entry"); 
-                    xml_item; 
-                    xml_item = xml_item->NextSiblingElement("entry")) 
-                {
-                    item new_item;
-                    title = xml_item->FirstChildElement("title");
-                    if (title) {
-                        new_item.title = title->GetText();
-                    }
-                    link = xml_item->FirstChildElement("link");
-                    if (link) {
-                        new_item.link = link->Attribute("href");
-                    }
-                    description = xml_item->FirstChildElement("summary");
-                    if (description) {
-                        new_item.description = description->GetText();
-                    }
-                    else if (description = xml_item->FirstChildElement("content"); description) {
-                        new_item.description = description->GetText();
-                    }
-                    // look for a media:group tag
-                    if (auto media_group = xml_item->FirstChildElement("media:group"); media_group) {
-                        if (auto media_content = media_group->FirstChildElement("media:content"); media_content) {
-                            new_item.enclosure = media_content->Attribute("url");
-                        }
-                        // look for a media:thumbnail tag
-                        if (auto media_thumbnail = media_group->FirstChildElement("media:thumbnail"); media_thumbnail) {
-                            new_item.image_url = media_thumbnail->Attribute("url");
-                            // if the feed doesn't have an image, asign the first thumbnail found
-                            if (feed_image_url.empty()) {
-                                set_image(new_item.image_url);
-                            }
-                        }
-                    }
-                    // get the updated time from an object similar to
-                    // <updated>2024-12-07T06:49:08+00:00</updated>
-                    if (auto updated = xml_item->FirstChildElement("updated"); updated) {
-                        std::istringstream updated_istr{updated->GetText()};
-                        updated_istr >> std::chrono::parse("%FT%T%Ez", new_item.updated);
-                    }
-                    items.emplace_back(std::move(new_item));
+                capture_ = nullptr;
+            }
+            auto const feed_depth {atom_ ? 2u : 3u};
+            if (in_item_ && depth == feed_depth) {
+                in_item_ = false;
+                finish_item();
+            }
+            path_.pop_back();
+        }
+
+        void finish_item() {
+            // if there is no direct enclosure, we can try to get one if the link is to youtube
+            if (item_.enclosure.empty() && item_.link.find("youtube.com") != std::string::npos) {
+                item_.enclosure = item_.link;
+            }
+            if (!item_date_.empty()) {
+                // <pubDate>Tue, 14 Apr 2020 18:16:11 +0000</pubDate> or <updated>2024-12-07T06:49:08+00:00</updated>
+                std::istringstream date_istr{item_date_};
+                date_istr >> std::chrono::parse(atom_ ? "%FT%T%Ez" : "%a, %d %b %Y %T %z", item_.updated);
+            }
+            // if the feed doesn't have an image, asign the first thumbnail found
+            if (atom_ && !item_.image_url.empty()) {
+                offer_image(5, item_.image_url);
+            }
+            if (known_ && known_(item_)) {
+                if (++known_streak_ >= known_streak_limit) {
+                    stopped_ = true;
                 }
+                return;
             }
+            known_streak_ = 0;
+            items_.emplace_back(std::move(item_));
         }
 
-        std::string source_link;
-        std::string contents;
-        std::string feed_title;
-        std::string feed_link;
-        std::string feed_description;
-        std::vector<item> items;
-        std::function<std::string(std::string_view)> system_runner_;
-        long long repo_id;
-        std::set<std::string> tags;
+        // the feed image comes from the best of several tags, lower priority first
+        void offer_image(int priority, std::string_view url) {
+            if (!url.empty() && priority < image_priority_) {
+                image_priority_ = priority;
+                target_.set_image(std::string{url});
+            }
+        }
 
-    private:
-        std::string feed_image_url;
+        void start_capture(std::string &field) {
+            capture_ = &field;
+            capture_depth_ = path_.size();
+        }
+
+        static void trim(std::string &text) {
+            auto const first = text.find_first_not_of(" \t\r\n");
+            if (first == std::string::npos) {
+                text.clear();
+                return;
+            }
+            text.erase(text.find_last_not_of(" \t\r\n") + 1);
+            text.erase(0, first);
+        }
+
+        feed &target_;
+        feed::items_t &items_;
+        known_t known_;
+        std::vector<std::string> path_;
+        bool atom_{false};
+        bool in_item_{false};
+        feed::item item_;
+        bool item_link_set_{false};
+        bool summary_seen_{false};
+        std::string item_date_;
+        bool title_seen_{false};
+        bool link_seen_{false};
+        bool description_seen_{false};
+        std::string image_text_;
+        int image_text_priority_{0};
+        int image_priority_{100};
+        std::string *capture_{nullptr};
+        size_t capture_depth_{0};
+        int known_streak_{0};
+        bool stopped_{false};
+        xml_stream xml_;
     };
-}
\ No newline at end of file
+}
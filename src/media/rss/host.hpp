@@ -2,160 +2,233 @@
 
 #include <algorithm>
 #include <atomic>
-#include <ctime>
+#include <chrono>
+#include <format>
 #include <functional>
-#include <iomanip>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <stop_token>
 #include <string>
 #include <vector>
 #include <thread>
+#include <unordered_map>
 
 #include "../../registrar.hpp"
 #include "../../hosting/http/fetch.hpp"
+#include "../../services/summarize.hpp"
+#include "../../util/hashing/sha256.hpp"
 #include "feed.hpp"
+#include "refresh.hpp"
 #include "sqliterepo.hpp"
 
 namespace media::rss
 {
     struct host
     {
+        struct options_t {
+            size_t summary_prefetch{20};
+            unsigned int summary_workers{2};
+
+            // also from the "feeds" section of beatograph.json, e.g. {"summary-prefetch": 20, "summary-workers": 2}
+            static options_t from_json(nlohmann::json const &node) {
+                options_t result;
+                if (node.contains("summary-prefetch")) {
+                    result.summary_prefetch = node.at("summary-prefetch").get<size_t>();
+                }
+                if (node.contains("summary-workers")) {
+                    result.summary_workers = std::max(1u, node.at("summary-workers").get<unsigned int>());
+                }
+                return result;
+            }
+        };
+
+        static options_t &options() {
+            static options_t options;
+            return options;
+        }
+
         host(std::function<std::string(std::string_view)> system_runner) : system_runner_(system_runner)
         {
             std::vector<std::string> urls;
-            repo_.scan_feeds([this, &urls](long long feed_id, const char * url, const char * title, const char * image_url) {
+            // only the feeds, their items are paged in when they are opened
+            repo_.scan_feeds([this, &urls](long long feed_id, std::string const &url, std::string const &title, std::string const &image_url, std::chrono::system_clock::time_point latest) {
                 auto feed_ptr = std::make_shared<media::rss::feed>(system_runner_);
                 feed_ptr->feed_title = title;
                 feed_ptr->source_link = url;
                 feed_ptr->feed_link = url;
                 feed_ptr->set_image(image_url);
                 feed_ptr->repo_id = feed_id;
-                repo_.scan_items(feed_id, [feed_ptr](const char * link, const char * enclosure, const char * title, const char * description, const char * pub_date, const char * image_url) {
-                    // the published date time appears as a string of format "2024-12-07 06:49:08"
-                    std::tm tm = {};
-                    std::istringstream ss(pub_date);
-                    ss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
-                    if (ss.fail()) {
-                        throw std::runtime_error("Failed to parse date");
-                    }
-                    auto const published_date = std::chrono::system_clock::from_time_t(std::mktime(&tm));
-                    feed_ptr->items.emplace_back(media::rss::feed::item{
-                        title, link, description, enclosure, image_url, published_date});
-                });
+                feed_ptr->stored_latest = latest;
                 auto feeds = feeds_.load();
                 feeds->emplace_back(feed_ptr);
+                register_feed(feed_ptr);
                 urls.emplace_back(url);
             });
+            auto feeds = feeds_.load();
+            std::stable_sort(feeds->begin(), feeds->end(), newer_feed_first);
             add_feeds(std::move(urls));
-        }
-
-        ~host() {
-            // make sure the thread ends before the repo is destroyed
-            fetch_thread_.request_stop();
+            prefetch_summaries();
         }
 
         static size_t writeCallback(void *contents, size_t size, size_t nmemb, void *userp)
         {
-            auto parser = static_cast<rss::feed *>(userp);
-            (*parser)(std::string_view{static_cast<char *>(contents), size * nmemb});
-            return size * nmemb;
+            auto reader = static_cast<rss::feed_reader *>(userp);
+            (*reader)(std::string_view{static_cast<char *>(contents), size * nmemb});
+            // taking less than we were given makes curl stop the download
+            return reader->stopped() ? 0 : size * nmemb;
         }
 
         void add_feeds(std::vector<std::string> urls)
         {
-            fetch_thread_ = std::jthread([this, urls] {
-                auto quit_job = "quitting"_fnb;
-                for (auto const &url_str : urls) {
-                    try {
-                        add_feed_sync(url_str, quit_job);
-                    } 
-                    catch(std::exception const &e) {
-                        "notify"_sfn(std::format("Failed to add feed {}: {}\n", url_str, e.what()));
-                    }
-                    catch(...) {
-                        "notify"_sfn(std::format("Failed to add feed {}\n", url_str));
-                    }
-                    if (quit_job()) break;
-                }
-                });
+            refresh_.add(urls);
+        }
+
+        refresh_queue::progress_t refresh_progress() const
+        {
+            return refresh_.progress();
         }
 
         std::shared_ptr<media::rss::feed> add_feed_sync(std::string_view url, auto quitting)
         {
-            auto feed_ptr = std::make_shared<media::rss::feed>(get_feed(url, system_runner_));
+            std::shared_ptr<media::rss::feed> existing;
             {
-                if (quitting()) return nullptr;
+                std::lock_guard<std::mutex> lock(merge_mutex());
+                existing = find_feed(url, url);
+            }
+            // download and parse on the calling worker, outside of any lock
+            rss::feed::items_t items;
+            auto fetched = get_feed(url, system_runner_, items, [this, &existing](media::rss::feed::item const &item) {
+                if (!existing) return false;
+                {
+                    std::lock_guard<std::mutex> lock(merge_mutex());
+                    if (existing->knows(item)) return true;
+                }
+                // most of what is stored was never paged in
+                return existing->repo_id >= 0 && repo_.has_item(existing->repo_id, item.link);
+            });
+            if (quitting()) return nullptr;
 
-                static std::mutex mutex;
-                std::lock_guard<std::mutex> lock(mutex);
-                auto feeds = feeds_.load();
-                // does the feed already exist?
-                auto pos = std::find_if(feeds->begin(), feeds->end(),
-                                        [ourlink = feed_ptr->feed_link, oursrc = feed_ptr->source_link](auto const &f)
-                                        {
-                                            return f->feed_link == ourlink || f->source_link == oursrc;
-                                        });
-                // add or merge with the new one
-                if (pos != feeds->end())
+            std::shared_ptr<media::rss::feed> feed_ptr;
+            std::vector<media::rss::feed::item> fresh_items;
+            {
+                std::lock_guard<std::mutex> lock(merge_mutex());
+                // readers keep the lists they loaded, feeds and items alike, we publish new ones
+                auto feeds = std::make_shared<std::vector<std::shared_ptr<rss::feed>>>(*feeds_.load());
+                feed_ptr = find_feed(fetched->feed_link, fetched->source_link);
+                if (feed_ptr)
                 {
-                    // update the feed
-                    feed_ptr->repo_id = (*pos)->repo_id;
-                    (*pos)->feed_title = feed_ptr->feed_title;
-                    (*pos)->feed_description = feed_ptr->feed_description;
-                    (*pos)->feed_link = feed_ptr->feed_link;
-                    (*pos)->set_image(feed_ptr->image_url());
-                    // now merge all items, avoiding duplicates
-                    for (auto const &item : feed_ptr->items)
+                    // take it out from where its previous newest item placed it
+                    auto const [first, last] = std::equal_range(feeds->begin(), feeds->end(), feed_ptr, newer_feed_first);
+                    if (auto const pos = std::find(first, last, feed_ptr); pos != last)
                     {
-                        auto item_pos = std::find_if((*pos)->items.begin(), (*pos)->items.end(),
-                                                     [ourlink = item.link](auto const &i)
-                                                     {
-                                                         return i.link == ourlink;
-                                                     });
-                        if (item_pos == (*pos)->items.end())
-                        {
-                            (*pos)->items.emplace_back(item);
-                        }
+                        feeds->erase(pos);
+                    }
+                    // update the feed; its links stay, a new one is only another way to find it
+                    feed_ptr->set_details(fetched->feed_title, fetched->feed_description);
+                    feed_ptr->set_image(fetched->image_url());
+                    fresh_items = feed_ptr->merge_items(std::move(items));
+                    if (!fetched->feed_link.empty()) {
+                        feeds_by_link_[fetched->feed_link] = feed_ptr;
                     }
-                    feed_ptr = *pos;
                 }
                 else
                 {
-                    feeds->emplace_back(feed_ptr);
+                    feed_ptr = fetched;
+                    fresh_items = feed_ptr->merge_items(std::move(items));
                 }
-                feed_ptr->repo_id = repo_.upsert_feed(url, feed_ptr->feed_title, feed_ptr->image_url());
-                // update the items
-                for (auto const &item : feed_ptr->items)
-                {
-                    // format the date time
-                    auto const pub_date = std::format("{:%F %T}", item.updated, item.updated);
-                    repo_.upsert_item(feed_ptr->repo_id, 
-                        item.title, 
-                        item.enclosure,
-                        item.link, 
-                        item.description, 
-                        pub_date, 
-                        item.image_url);
-                }
-                // sort the feeds from the latest updated to the oldest
-                std::sort(feeds->begin(), feeds->end(),
-                          [](auto const &lhs, auto const &rhs)
-                          {
-                              return lhs->items.empty() ? false : (rhs->items.empty() ? true : lhs->items.front().updated > rhs->items.front().updated);
-                          });
+                register_feed(feed_ptr);
+                // keep the feeds from the latest updated to the oldest
+                feeds->insert(std::upper_bound(feeds->begin(), feeds->end(), feed_ptr, newer_feed_first), feed_ptr);
                 feeds_.store(feeds);
             }
+            // persisting does not hold up the merge of the next feed
+            feed_ptr->repo_id = repo_.save_feed(url, feed_ptr->details().first, feed_ptr->image_url(), fresh_items);
+            if (!fresh_items.empty()) {
+                prefetch_summaries();
+            }
             return feed_ptr;
         }
 
+        // A summary on its way: the text so far, whether it is complete, and whether it
+        // was stopped before that, which leaves no text.
+        struct summary_t {
+            std::string text;
+            bool done;
+            bool stopped;
+        };
+
+        // The summary of the item's article as far as it is written: from the cache in the
+        // database, else streamed in from the summarizer by a summaries_ worker, call after
+        // call showing more of it. Finished ones stay with their job for the session.
+        summary_t summary(rss::feed::item const &item)
+        {
+            auto const job = summary_job(item.link);
+            std::lock_guard lock{job->mutex};
+            return {job->text, job->done, job->stopped};
+        }
+
+        // stops the summary of the item mid-stream, whether it was asked for or prefetched
+        void cancel_summary(rss::feed::item const &item)
+        {
+            std::lock_guard lock{summary_jobs_mutex_};
+            if (auto const it = summary_jobs_.find(item.link); it != summary_jobs_.end()) {
+                it->second->stop.request_stop();
+            }
+        }
+
+        // Queues the newest items without a summary to be summarized in the background,
+        // options().summary_workers at a time.
+        void prefetch_summaries()
+        {
+            if (options().summary_prefetch == 0) return;
+            summaries_.add(repo_.unsummarized_links(services::summarize::model, services::summarize::prompt_version, options().summary_prefetch));
+        }
+
         auto feeds()
         {
             return *feeds_.load();
         }
 
+        // Queues the next page of stored items to be read and merged with what refreshes
+        // already brought, on a worker; calls while one is on its way are ignored.
+        void load_more(std::shared_ptr<rss::feed> const &feed)
+        {
+            if (feed->all_pages_loaded || feed->repo_id < 0) return;
+            pages_.add({feed->source_link});
+        }
+
+        // the description of an item; for paged in ones read from the database the first time,
+        // and kept here since published items are never changed
+        std::string description(rss::feed::item const &item)
+        {
+            if (item.description_loaded) {
+                return item.description;
+            }
+            {
+                std::lock_guard lock{descriptions_mutex_};
+                if (auto const it = descriptions_.find(item.link); it != descriptions_.end()) {
+                    return it->second;
+                }
+            }
+            auto description = repo_.item_description(item.link).value_or("");
+            std::lock_guard lock{descriptions_mutex_};
+            return descriptions_.emplace(item.link, std::move(description)).first->second;
+        }
+
+        static constexpr size_t page_size{50};
+
+        // stored items matching text, best first; feed writes in progress do not hold it up
+        std::vector<sqliterepo::search_hit_t> search(std::string_view text)
+        {
+            return repo_.search(text);
+        }
+
         void delete_feed(std::string_view url)
         {
-            auto feeds = feeds_.load();
+            std::lock_guard<std::mutex> lock(merge_mutex());
+            auto feeds = std::make_shared<std::vector<std::shared_ptr<rss::feed>>>(*feeds_.load());
             auto pos = std::find_if(feeds->begin(), feeds->end(),
                                     [url](auto const &f)
                                     {
@@ -163,6 +236,7 @@ namespace media::rss
                                     });
             if (pos != feeds->end())
             {
+                std::erase_if(feeds_by_link_, [feed = *pos](auto const &entry) { return entry.second == feed; });
                 feeds->erase(pos);
                 feeds_.store(feeds);
                 repo_.delete_feed(url);
@@ -172,16 +246,205 @@ namespace media::rss
     private:
         std::atomic<std::shared_ptr<std::vector<std::shared_ptr<rss::feed>>>> feeds_ = std::make_shared<std::vector<std::shared_ptr<rss::feed>>>();
         std::function<std::string(std::string_view)> system_runner_;
-        std::jthread fetch_thread_;
+        std::unordered_map<std::string, std::shared_ptr<rss::feed>> feeds_by_link_;
 
-        static feed get_feed(std::string_view url, std::function<std::string(std::string_view)> system_runner)
+        static bool newer_feed_first(std::shared_ptr<rss::feed> const &lhs, std::shared_ptr<rss::feed> const &rhs)
+        {
+            return lhs->latest() > rhs->latest();
+        }
+
+        // by feed link or source link; merge_mutex must be held
+        std::shared_ptr<rss::feed> find_feed(std::string_view feed_link, std::string_view source_link) const
+        {
+            for (auto const link : {feed_link, source_link})
+            {
+                if (auto const it = feeds_by_link_.find(std::string{link}); it != feeds_by_link_.end())
+                {
+                    return it->second;
+                }
+            }
+            return nullptr;
+        }
+
+        void register_feed(std::shared_ptr<rss::feed> const &feed)
+        {
+            feeds_by_link_[feed->feed_link] = feed;
+            feeds_by_link_[feed->source_link] = feed;
+        }
+
+        static std::mutex &merge_mutex()
+        {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        // the feed's details in a new, unpublished feed, and its items in items
+        static std::shared_ptr<feed> get_feed(std::string_view url, std::function<std::string(std::string_view)> system_runner, feed::items_t &items, feed_reader::known_t known = {})
         {
             http::fetch fetch;
-            feed parser{system_runner};
-            parser.source_link = url;
-            fetch(std::string{url}, [](auto h){}, writeCallback, &parser);
+            auto parser = std::make_shared<feed>(system_runner);
+            parser->source_link = url;
+            feed_reader reader{*parser, items, std::move(known)};
+            try {
+                fetch(std::string{url}, [](auto h){}, writeCallback, &reader);
+            }
+            catch (std::exception const &) {
+                // stopping at the known items aborts the transfer on purpose
+                if (!reader.stopped()) throw;
+            }
             return parser;
         }
+
+        struct summary_job_t {
+            std::mutex mutex;
+            std::string text;
+            bool done{false};
+            bool stopped{false};
+            std::stop_source stop;
+            // guarded by summary_jobs_mutex_, set by the worker that runs it
+            bool started{false};
+        };
+
+        // Jobs are shared by the screen and the prefetch queue, keyed by link, so an item
+        // being prefetched is not summarized (and paid for) a second time when it is opened.
+        std::shared_ptr<summary_job_t> summary_job(std::string const &link)
+        {
+            std::lock_guard lock{summary_jobs_mutex_};
+            auto &job = summary_jobs_[link];
+            if (job) {
+                return job;
+            }
+            job = std::make_shared<summary_job_t>();
+            // on the same bounded workers as prefetch, ahead of it, and joined with them
+            summaries_.add({link}, true);
+            return job;
+        }
+
+        // the job for a link a summaries_ worker got to, unless another one already ran it
+        std::shared_ptr<summary_job_t> claim_summary_job(std::string const &link)
+        {
+            std::lock_guard lock{summary_jobs_mutex_};
+            auto &job = summary_jobs_[link];
+            if (!job) {
+                job = std::make_shared<summary_job_t>();
+            }
+            else if (job->started) {
+                return nullptr;
+            }
+            job->started = true;
+            return job;
+        }
+
+        // streams the summary into the job; stopping the worker stops the job too
+        void run_summary_job(std::string const &link, summary_job_t &job, std::stop_token worker_stop)
+        {
+            std::stop_callback forward{worker_stop, [&job] { job.stop.request_stop(); }};
+            std::optional<std::string> result;
+            try {
+                result = summarize_link(link, [&job](std::string_view delta) {
+                    std::lock_guard lock{job.mutex};
+                    job.text += delta;
+                }, job.stop.get_token());
+            }
+            catch (std::exception const &e) {
+                result = e.what();
+            }
+            std::lock_guard lock{job.mutex};
+            if (result) {
+                // a cached summary arrives whole, without deltas
+                job.text = result->empty() ? "No summary" : *result;
+            }
+            else {
+                // what was streamed so far is not the summary
+                job.text.clear();
+                job.stopped = true;
+            }
+            job.done = true;
+        }
+
+        // reads the page after the feed's cursor and publishes the merged items; false once there is nothing more
+        bool load_page(std::string const &source_link, size_t count = page_size)
+        {
+            std::shared_ptr<rss::feed> feed;
+            std::optional<rss::feed::page_cursor_t> cursor;
+            {
+                std::lock_guard<std::mutex> lock(merge_mutex());
+                feed = find_feed(source_link, source_link);
+                if (!feed || feed->all_pages_loaded || feed->repo_id < 0) return false;
+                cursor = feed->page_cursor;
+            }
+            auto page = repo_.page_items(feed->repo_id, cursor, count);
+            bool const last_page {page.size() < count};
+            std::lock_guard<std::mutex> lock(merge_mutex());
+            if (!page.empty()) {
+                auto const &last = page.back();
+                feed->page_cursor = rss::feed::page_cursor_t{
+                    std::chrono::duration_cast<std::chrono::seconds>(last.updated.time_since_epoch()).count(), last.link};
+            }
+            feed->merge_items(std::move(page));
+            // only once the items are in, so the screen never sees the end before them
+            if (last_page) {
+                feed->all_pages_loaded = true;
+            }
+            return !last_page;
+        }
+
+        std::optional<std::string> summarize_link(std::string const &link, services::summarize::delta_sink_t on_delta = {}, std::stop_token stop = {})
+        {
+            using services::summarize;
+            // an article once summarized is not downloaded again
+            if (auto cached = repo_.summary_for_link(link, summarize::model, summarize::prompt_version)) {
+                return cached;
+            }
+            auto const contents = http::fetch{}(link);
+            // the same text may have been summarized under another link
+            auto content_key = hashing::sha256::hex(std::format("{}\x1f{}\x1f{}", contents, summarize::model, summarize::prompt_version));
+            if (auto cached = repo_.summary_for_key(content_key)) {
+                return cached;
+            }
+            auto const summarizer = registrar::get<summarize::stream_t>({});
+            auto text = (*summarizer)(contents, std::move(on_delta), stop);
+            if (text) {
+                repo_.save_summary(std::move(content_key), link, summarize::model, summarize::prompt_version, *text);
+            }
+            return text;
+        }
+
+        std::mutex descriptions_mutex_;
+        std::unordered_map<std::string, std::string> descriptions_;
+        std::mutex summary_jobs_mutex_;
+        std::unordered_map<std::string, std::shared_ptr<summary_job_t>> summary_jobs_;
         sqliterepo repo_{"rss.db"};
+        refresh_queue summaries_{[this](std::string const &link, std::stop_token stop) {
+            if (stop.stop_requested() || "quitting"_fnb()) return false;
+            auto const job = claim_summary_job(link);
+            if (!job) {
+                return true;
+            }
+            run_summary_job(link, *job, stop);
+            std::lock_guard lock{job->mutex};
+            return !job->stopped;
+        }, options().summary_workers};
+        // one page load at a time is plenty for one screen
+        refresh_queue pages_{[this](std::string const &source_link, std::stop_token stop) {
+            if (stop.stop_requested()) return false;
+            load_page(source_link);
+            return true;
+        }, 1};
+        // declared last so its workers are joined before the repo goes away
+        refresh_queue refresh_{[this](std::string const &url, std::stop_token stop) {
+            auto quit_job = "quitting"_fnb;
+            try {
+                add_feed_sync(url, [&stop, &quit_job] { return stop.stop_requested() || quit_job(); });
+                return true;
+            }
+            catch(std::exception const &e) {
+                "notify"_sfn(std::format("Failed to add feed {}: {}\n", url, e.what()));
+            }
+            catch(...) {
+                "notify"_sfn(std::format("Failed to add feed {}\n", url));
+            }
+            return false;
+        }};
     };
 }
\ No newline at end of file
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace media::rss {
+    // Refreshes feeds on a pool of workers, with at most per_domain of them talking to
+    // the same server at a time. Keeps count of the current batch for the screen.
+    struct refresh_queue {
+        struct options_t {
+            unsigned int workers{8};
+            unsigned int per_domain{2};
+
+            // reads the "feeds" section of beatograph.json, e.g. {"workers": 8, "per-domain": 2}
+            static options_t from_json(nlohmann::json const &node) {
+                options_t result;
+                if (node.contains("workers")) {
+                    result.workers = std::max(1u, node.at("workers").get<unsigned int>());
+                }
+                if (node.contains("per-domain")) {
+                    result.per_domain = std::max(1u, node.at("per-domain").get<unsigned int>());
+                }
+                return result;
+            }
+        };
+
+        struct progress_t {
+            size_t total{0};
+            size_t done{0};
+            size_t failed{0};
+            std::vector<std::string> active;
+
+            bool busy() const { return done < total; }
+        };
+
+        // refreshes one url, false when it failed
+        using job_t = std::function<bool(std::string const &url, std::stop_token stop)>;
+
+        static options_t &options() {
+            static options_t options;
+            return options;
+        }
+
+        explicit refresh_queue(job_t job) : job_{std::move(job)} {}
+
+        // a queue with its own number of workers rather than the configured one
+        refresh_queue(job_t job, unsigned int workers) : job_{std::move(job)}, max_workers_{std::max(1u, workers)} {}
+
+        refresh_queue(refresh_queue const &) = delete;
+
+        ~refresh_queue() {
+            for (auto &worker : workers_) {
+                worker.request_stop();
+            }
+            // the jthreads join here, after their waits were interrupted
+        }
+
+        // urgent urls go ahead of the queue, moving there if they were already waiting
+        void add(std::vector<std::string> const &urls, bool urgent = false) {
+            {
+                std::lock_guard lock{mutex_};
+                if (queue_.empty() && active_.empty()) {
+                    // a new batch
+                    total_ = done_ = failed_ = 0;
+                }
+                for (auto const &url : urls) {
+                    if (auto const queued = std::find(queue_.begin(), queue_.end(), url); queued != queue_.end()) {
+                        if (urgent) {
+                            queue_.erase(queued);
+                            queue_.push_front(url);
+                        }
+                    }
+                    else if (!active_.contains(url)) {
+                        if (urgent) {
+                            queue_.push_front(url);
+                        }
+                        else {
+                            queue_.push_back(url);
+                        }
+                        ++total_;
+                    }
+                }
+                while (workers_.size() < max_workers_.value_or(options().workers) && workers_.size() < queue_.size() + active_.size()) {
+                    workers_.emplace_back([this](std::stop_token stop) { work(stop); });
+                }
+            }
+            cv_.notify_all();
+        }
+
+        progress_t progress() const {
+            std::lock_guard lock{mutex_};
+            return {total_, done_, failed_, {active_.begin(), active_.end()}};
+        }
+
+        // "https://www.example.com:8080/feed" -> "example.com"
+        static std::string domain_of(std::string_view url) {
+            if (auto const scheme = url.find("://"); scheme != std::string_view::npos) {
+                url.remove_prefix(scheme + 3);
+            }
+            url = url.substr(0, url.find_first_of("/?#"));
+            if (auto const at = url.rfind('@'); at != std::string_view::npos) {
+                url.remove_prefix(at + 1);
+            }
+            std::string result{url.substr(0, url.find(':'))};
+            std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            if (result.starts_with("www.")) {
+                result.erase(0, 4);
+            }
+            return result;
+        }
+
+    private:
+        // the first queued url whose server has a free slot
+        std::deque<std::string>::iterator next_runnable() {
+            return std::find_if(queue_.begin(), queue_.end(), [this](auto const &url) {
+                auto const it = active_by_domain_.find(domain_of(url));
+                return it == active_by_domain_.end() || it->second < options().per_domain;
+            });
+        }
+
+        void work(std::stop_token stop) {
+            std::unique_lock lock{mutex_};
+            while (!stop.stop_requested()) {
+                if (!cv_.wait(lock, stop, [this] { return next_runnable() != queue_.end(); })) {
+                    break;
+                }
+                auto const it = next_runnable();
+                auto const url {*it};
+                queue_.erase(it);
+                auto const domain {domain_of(url)};
+                ++active_by_domain_[domain];
+                active_.insert(url);
+                lock.unlock();
+                bool ok {false};
+                try {
+                    ok = job_(url, stop);
+                }
+                catch (...) {}
+                lock.lock();
+                if (--active_by_domain_[domain] == 0) {
+                    active_by_domain_.erase(domain);
+                }
+                active_.erase(url);
+                ++done_;
+                if (!ok) {
+                    ++failed_;
+                }
+                // a slot on this server is free again
+                cv_.notify_all();
+            }
+        }
+
+        job_t job_;
+        std::optional<unsigned int> max_workers_;
+        mutable std::mutex mutex_;
+        std::condition_variable_any cv_;
+        std::deque<std::string> queue_;
+        std::set<std::string> active_;
+        std::map<std::string, unsigned int> active_by_domain_;
+        size_t total_{0};
+        size_t done_{0};
+        size_t failed_{0};
+        std::vector<std::jthread> workers_;
+    };
+}
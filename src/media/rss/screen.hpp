@@ -40,8 +40,9 @@ namespace media::rss
                     // ImGui::Text("Failed to load image");
                 }
             }
-            ImGui::TextWrapped("%s", current_feed_->feed_title.c_str());
-            ImGui::TextWrapped("%s", current_feed_->feed_description.c_str());
+            auto const [title, description] = current_feed_->details();
+            ImGui::TextWrapped("%s", title.c_str());
+            ImGui::TextWrapped("%s", description.c_str());
         }
 
         // Renders the list of items in the current feed
@@ -58,8 +59,21 @@ namespace media::rss
                 ImGui::TableSetupColumn("Title", ImGuiTableColumnFlags_WidthStretch);
                 ImGui::TableSetupColumn("Updated", ImGuiTableColumnFlags_WidthFixed, 112);
                 ImGui::TableHeadersRow();
-                for (auto &item : current_feed_->items)
+                // refreshes and page loads publish new lists, this one stays valid for the frame
+                auto const items = current_feed_->items();
+                for (auto const &item : *items)
                 {
+                    if (item.link == say_when_summarized_)
+                    {
+                        if (auto const summary = host_->summary(item); summary.done)
+                        {
+                            say_when_summarized_.clear();
+                            if (!summary.stopped)
+                            {
+                                say(summary.text);
+                            }
+                        }
+                    }
                     if (!filter_.empty() && item.title.find(filter_) == std::string::npos)
                     {
                         continue;
@@ -72,36 +86,67 @@ namespace media::rss
                         item_text = ICON_MD_PLAY_CIRCLE " ";
                     }
                     item_text += item.title;
-                    if (ImGui::Selectable(item_text.c_str()))
+                    auto const clicked {ImGui::Selectable(item_text.c_str())};
+                    if (ImGui::IsItemHovered())
+                    {
+                        if (auto const description = host_->description(item); !description.empty())
+                        {
+                            ImGui::BeginTooltip();
+                            ImGui::PushTextWrapPos(480);
+                            ImGui::TextUnformatted(description.c_str());
+                            ImGui::PopTextWrapPos();
+                            ImGui::EndTooltip();
+                        }
+                    }
+                    if (clicked)
                     {
                         if (!item.enclosure.empty())
                         {
-                            if (item.enclosure.find("youtube.com") != std::string::npos)
+                            auto enclosure {item.enclosure};
+                            if (enclosure.find("youtube.com") != std::string::npos)
                             {
-                                auto const cmd{std::format("yt-dlp -f bestaudio -g {}", item.enclosure)};
-                                item.enclosure = system_runner_(cmd);
+                                auto const cmd{std::format("yt-dlp -f bestaudio -g {}", enclosure)};
+                                enclosure = system_runner_(cmd);
                             }
-                            player_(item.enclosure);
+                            player_(enclosure);
                         }
-                        else {
-                            try {
-                                auto text = item.summary();
-                                auto say = registrar::get<std::function<void(std::string_view)>>("say");
-                                (*say)(text);
-                            }
-                            catch (std::exception const &e)
-                            {
-                                latest_error_ = e.what();
+                        else if (auto const summary = host_->summary(item); summary.done) {
+                            if (!summary.stopped) {
+                                say(summary.text);
                             }
                         }
+                        else {
+                            // read it out once it is all written
+                            say_when_summarized_ = item.link;
+                        }
                     }
                     if (ImGui::CollapsingHeader(std::format("Summary##{}", item.title).c_str())) {
-                        ImGui::TextWrapped(item.summary().data());
+                        auto const summary = host_->summary(item);
+                        if (summary.stopped) {
+                            ImGui::TextDisabled("Stopped");
+                        }
+                        else {
+                            ImGui::TextWrapped("%s", summary.text.c_str());
+                        }
+                        if (!summary.done && ImGui::SmallButton(std::format(ICON_MD_STOP "##{}", item.link).c_str())) {
+                            host_->cancel_summary(item);
+                        }
                     }
                     ImGui::TableNextColumn();
                     auto updated = std::format("{:%Y-%m-%d %H:%M}", item.updated);
                     ImGui::TextUnformatted(updated.c_str());
                 }
+                if (!current_feed_->all_pages_loaded)
+                {
+                    // the next page is read once this row scrolls into view
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::TextDisabled("Loading...");
+                    if (ImGui::IsItemVisible())
+                    {
+                        host_->load_more(current_feed_);
+                    }
+                }
                 ImGui::EndTable();
             }
             ImGui::EndChild();
@@ -150,6 +195,21 @@ namespace media::rss
             {
                 if (ImGui::BeginChild("RSS", ImVec2{ImGui::GetWindowWidth() - 20, ImGui::GetWindowHeight() - ImGui::GetCursorPosY() - 20}))
                 {
+                    if (auto const progress = host_->refresh_progress(); progress.busy())
+                    {
+                        auto const label = std::format("Refreshing {}/{} feeds{}", progress.done, progress.total,
+                            progress.failed ? std::format(", {} failed", progress.failed) : std::string{});
+                        ImGui::ProgressBar(static_cast<float>(progress.done) / static_cast<float>(progress.total), ImVec2{-1, 0}, label.c_str());
+                        if (ImGui::IsItemHovered() && !progress.active.empty())
+                        {
+                            ImGui::BeginTooltip();
+                            for (auto const &url : progress.active)
+                            {
+                                ImGui::TextUnformatted(url.c_str());
+                            }
+                            ImGui::EndTooltip();
+                        }
+                    }
                     constexpr float side_length{160};
                     const unsigned col_count{static_cast<unsigned>(ImGui::GetWindowWidth() / (side_length + 10))};
                     const ImVec2 button_size(side_length, side_length);
@@ -219,6 +279,18 @@ namespace media::rss
         }
 
     private:
+        void say(std::string_view text)
+        {
+            try {
+                auto say = registrar::get<std::function<void(std::string_view)>>("say");
+                (*say)(text);
+            }
+            catch (std::exception const &e)
+            {
+                latest_error_ = e.what();
+            }
+        }
+
         std::shared_ptr<host> host_;
         player_t player_;
         img_cache &cache_ = *registrar::get<img_cache>({});
@@ -227,5 +299,7 @@ namespace media::rss
         std::function<std::string(std::string_view)> system_runner_;
         bool configure_current_feed_{false};
         std::string latest_error_;
+        // an item without enclosure was clicked before its summary was ready
+        std::string say_when_summarized_;
     };
 }
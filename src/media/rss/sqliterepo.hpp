@@ -1,6 +1,18 @@
 #pragma once
 
-#include "../../hosting/db/sqlite.hpp"
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "../../hosting/db/database.hpp"
+#include "../../util/hashing/sha256.hpp"
+#include "feed.hpp"
 
 namespace media::rss
 {
@@ -8,86 +20,263 @@ namespace media::rss
     {
         sqliterepo(const std::string &path) : db_{path}
         {
-            db_.ensure_table("feed", "id INTEGER PRIMARY KEY AUTOINCREMENT, url TEXT UNIQUE, title TEXT, image_url TEXT, last_updated TEXT");
-            db_.ensure_table("item", "link TEXT PRIMARY KEY, enclosure TEXT, feed_id INTEGER, title TEXT, description TEXT, pub_date TEXT, image_url TEXT");
-        }
-
-        long long upsert_feed(std::string_view url, std::string_view title, std::string_view image_url)
-        {
-            std::string sql = "INSERT INTO feed (url, title, image_url, last_updated) "
-                              "VALUES (?, ?, ?, datetime('now')) "
-                              "ON CONFLICT(url) DO "
-                              "UPDATE SET title=excluded.title, image_url=excluded.image_url, last_updated=datetime('now') "
-                              "RETURNING id";
-            long long result {-1};
-            db_.exec(sql, [&result](sqlite3_stmt *stmt) {
-                result = sqlite3_column_int64(stmt, 0);
-            }, url, title, image_url);
-            if (result == -1) {
-                sql = "SELECT id FROM feed WHERE url = ?";
-                db_.exec(sql, [&result](sqlite3_stmt *stmt) {
-                    result = sqlite3_column_int64(stmt, 0);
-                }, url);
-            }
-            return result;
+            db_.write([](hosting::db::sqlite &db) {
+                db.ensure_table("feed", "id INTEGER PRIMARY KEY AUTOINCREMENT, url TEXT UNIQUE, title TEXT, image_url TEXT, last_updated TEXT");
+                db.ensure_table("item", "link TEXT PRIMARY KEY, enclosure TEXT, feed_id INTEGER, title TEXT, description TEXT, image_url TEXT, content_hash TEXT, pub_ts INTEGER");
+                // databases from before content_hash and pub_ts
+                auto const has_column = [&db](std::string_view column) {
+                    for (auto const &[name] : db.query<std::string_view>("SELECT name FROM pragma_table_info('item')")) {
+                        if (name == column) return true;
+                    }
+                    return false;
+                };
+                if (!has_column("content_hash")) {
+                    db.exec("ALTER TABLE item ADD COLUMN content_hash TEXT");
+                }
+                if (!has_column("pub_ts")) {
+                    // pub_date held "2024-12-07 06:49:08" in UTC
+                    db.exec("ALTER TABLE item ADD COLUMN pub_ts INTEGER");
+                    db.exec("UPDATE item SET pub_ts = CAST(strftime('%s', pub_date) AS INTEGER)");
+                }
+                db.exec("CREATE INDEX IF NOT EXISTS item_feed_pub ON item (feed_id, pub_ts DESC, link DESC)");
+                ensure_search_index(db);
+                db.exec("CREATE INDEX IF NOT EXISTS item_pub ON item (pub_ts DESC)");
+                // summaries by a hash of the article, the model and the prompt version
+                db.ensure_table("summary", "content_key TEXT PRIMARY KEY, link TEXT, model TEXT, prompt_version INTEGER, text TEXT, created INTEGER");
+                db.exec("CREATE INDEX IF NOT EXISTS summary_link ON summary (link, model, prompt_version)");
+            }).get();
         }
 
-        void upsert_item(long long feed_id, std::string_view title, std::string_view enclosure, std::string_view link, std::string_view description, std::string_view pub_date, std::string_view image_url)
+        // The feed row and its items, written by the writer thread in one transaction
+        // (a single sync to disk); waits for it to get the feed id.
+        long long save_feed(std::string_view url, std::string_view title, std::string_view image_url, std::vector<feed::item> const &items)
         {
-            std::string sql = "INSERT OR REPLACE INTO item (link, enclosure, feed_id, title, description, pub_date, image_url) VALUES (?, ?, ?, ?, ?, ?, ?)";
-            db_.exec(sql, {}, link, enclosure, feed_id, title, description, pub_date, image_url);
+            return db_.write([&](hosting::db::sqlite &db) {
+                auto const feed_id = upsert_feed(db, url, title, image_url);
+                for (auto const &item : items)
+                {
+                    upsert_item(db, feed_id, item);
+                }
+                return feed_id;
+            }).get();
         }
 
         void update_feed(std::string_view url, std::string_view title, std::string_view image_url)
         {
-            std::string sql = "UPDATE feed SET title = ?, image_url = ?, last_updated = datetime('now') WHERE url = ?";
-            db_.exec(sql, {}, title, image_url, url);
+            db_.post([url = std::string{url}, title = std::string{title}, image_url = std::string{image_url}](hosting::db::sqlite &db) {
+                db.exec("UPDATE feed SET title = ?, image_url = ?, last_updated = datetime('now') WHERE url = ?", {}, title, image_url, url);
+            });
         }
 
+        // queued, the caller does not wait for the disk
         void delete_feed(std::string_view url)
         {
-            long long feed_id = -1;
-            std::string sql = "SELECT id FROM feed WHERE url = ?";
-            db_.exec(sql, [&feed_id](sqlite3_stmt *stmt) {
-                feed_id = sqlite3_column_int64(stmt, 0);
-            }, url);
-
-            if (feed_id != -1) {
-                sql = "DELETE FROM item WHERE feed_id = ?";
-                db_.exec(sql, {}, feed_id);
+            db_.post([url = std::string{url}](hosting::db::sqlite &db) {
+                if (auto const feed_id = db.query_value<long long>("SELECT id FROM feed WHERE url = ?", url)) {
+                    db.exec("DELETE FROM item WHERE feed_id = ?", {}, *feed_id);
+                    db.exec("DELETE FROM feed WHERE url = ?", {}, url);
+                }
+            });
+        }
 
-                sql = "DELETE FROM feed WHERE url = ?";
-                db_.exec(sql, {}, url);
+        // sink(id, url, title, image_url, latest), latest being when its newest stored item was
+        // published; the rows are read first, so sink may read too
+        void scan_feeds(auto sink)
+        {
+            using row_t = std::tuple<long long, std::string, std::string, std::string, std::optional<long long>>;
+            auto const rows = db_.read([](hosting::db::sqlite &db) {
+                std::vector<row_t> result;
+                for (auto const &row : db.query<long long, std::string, std::string, std::string, std::optional<long long>>(
+                        "SELECT id, url, title, image_url, (SELECT max(pub_ts) FROM item WHERE feed_id = feed.id) FROM feed")) {
+                    result.push_back(row);
+                }
+                return result;
+            });
+            for (auto const &[id, url, title, image_url, latest] : rows) {
+                sink(id, url, title, image_url, latest ? to_time(*latest) : std::chrono::system_clock::time_point::min());
             }
         }
 
-        void scan_feeds(auto sink)
+        // Up to count stored items of a feed, newest first, that come after the cursor (the
+        // last item of the previous page, none for the first). Keyset pagination: each page
+        // costs the same however deep it is. Descriptions are left out, see item_description.
+        std::vector<feed::item> page_items(long long feed_id, std::optional<feed::page_cursor_t> const &after, size_t count)
         {
-            std::string sql = "SELECT id, url, title, image_url FROM feed";
-            db_.exec(sql, [&sink](sqlite3_stmt *stmt) {
-                sink(sqlite3_column_int64(stmt, 0), 
-                    reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)), 
-                    reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)), 
-                    reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3)));
+            auto const cursor = after.value_or(feed::page_cursor_t{std::numeric_limits<long long>::max(), {}});
+            return db_.read([&](hosting::db::sqlite &db) {
+                std::vector<feed::item> result;
+                result.reserve(count);
+                for (auto const &[link, enclosure, title, image_url, pub_ts] : db.query<std::string, std::string, std::string, std::string, long long>(
+                        "SELECT link, enclosure, title, image_url, pub_ts FROM item "
+                        "WHERE feed_id = ? AND (pub_ts, link) < (?, ?) "
+                        "ORDER BY pub_ts DESC, link DESC LIMIT ?", feed_id, cursor.pub_ts, cursor.link, static_cast<long long>(count))) {
+                    auto &added = result.emplace_back(title, link, std::string_view{}, enclosure, image_url, to_time(pub_ts));
+                    added.description_loaded = false;
+                }
+                return result;
             });
         }
 
-        void scan_items(long long feed_id, auto sink)
+        // whether the item is stored for the feed, loaded or not
+        bool has_item(long long feed_id, std::string const &link)
         {
-            std::string sql = "SELECT link, enclosure, title, description, pub_date, image_url FROM item WHERE feed_id = ? ORDER BY pub_date DESC";
-            db_.exec(sql, [&sink](sqlite3_stmt *stmt) {
-                sink(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)), 
-                     reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)), 
-                     reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)), 
-                     reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3)), 
-                     reinterpret_cast<const char *>(sqlite3_column_text(stmt, 4)),
-                     reinterpret_cast<const char *>(sqlite3_column_text(stmt, 5))
-                     );
-                return 0;
-            }, feed_id);
+            return db_.read([&](hosting::db::sqlite &db) {
+                return db.query_value<long long>("SELECT 1 FROM item WHERE link = ? AND feed_id = ?", link, feed_id).has_value();
+            });
+        }
+
+        std::optional<std::string> item_description(std::string const &link)
+        {
+            return db_.read([&link](hosting::db::sqlite &db) {
+                return db.query_value<std::string>("SELECT description FROM item WHERE link = ?", link);
+            });
+        }
+
+        // the latest summary of the article at link made with this model and prompt
+        std::optional<std::string> summary_for_link(std::string const &link, std::string_view model, int prompt_version)
+        {
+            return db_.read([&](hosting::db::sqlite &db) {
+                return db.query_value<std::string>("SELECT text FROM summary WHERE link = ? AND model = ? AND prompt_version = ? ORDER BY created DESC LIMIT 1",
+                    link, model, prompt_version);
+            });
+        }
+
+        std::optional<std::string> summary_for_key(std::string const &content_key)
+        {
+            return db_.read([&content_key](hosting::db::sqlite &db) {
+                return db.query_value<std::string>("SELECT text FROM summary WHERE content_key = ?", content_key);
+            });
+        }
+
+        void save_summary(std::string content_key, std::string link, std::string_view model, int prompt_version, std::string text)
+        {
+            db_.post([content_key = std::move(content_key), link = std::move(link), model = std::string{model}, prompt_version, text = std::move(text)](hosting::db::sqlite &db) {
+                db.exec("INSERT OR REPLACE INTO summary (content_key, link, model, prompt_version, text, created) VALUES (?, ?, ?, ?, ?, strftime('%s', 'now'))",
+                    {}, content_key, link, model, prompt_version, text);
+            });
+        }
+
+        // the links of the newest items, across feeds, with no summary from this model and prompt yet
+        std::vector<std::string> unsummarized_links(std::string_view model, int prompt_version, size_t count)
+        {
+            return db_.read([&](hosting::db::sqlite &db) {
+                std::vector<std::string> result;
+                for (auto const &[link] : db.query<std::string>(
+                        "SELECT link FROM item WHERE NOT EXISTS "
+                        "(SELECT 1 FROM summary WHERE summary.link = item.link AND model = ? AND prompt_version = ?) "
+                        "ORDER BY pub_ts DESC LIMIT ?", model, prompt_version, static_cast<long long>(count))) {
+                    result.push_back(link);
+                }
+                return result;
+            });
+        }
+
+        struct search_hit_t {
+            long long feed_id;
+            std::string feed_title;
+            std::string link;
+            std::string title;
+            std::string enclosure;
+            std::chrono::system_clock::time_point updated;
+        };
+
+        // Stored items matching every word of text (as a prefix), best first: bm25 over
+        // title and description, a title match counting ten times as much.
+        std::vector<search_hit_t> search(std::string_view text, size_t limit = 50)
+        {
+            auto const query = match_expression(text);
+            if (query.empty()) {
+                return {};
+            }
+            return db_.read([&](hosting::db::sqlite &db) {
+                std::vector<search_hit_t> result;
+                // ranking and limiting in the full-text table first keeps it to a few rows
+                for (auto const &[feed_id, feed_title, link, title, enclosure, pub_ts] : db.query<long long, std::string, std::string, std::string, std::string, long long>(
+                        "SELECT item.feed_id, feed.title, item.link, item.title, item.enclosure, item.pub_ts "
+                        "FROM (SELECT rowid, rank FROM item_fts WHERE item_fts MATCH ? ORDER BY rank LIMIT ?) AS hit "
+                        "JOIN item ON item.rowid = hit.rowid JOIN feed ON feed.id = item.feed_id "
+                        "ORDER BY hit.rank", query, static_cast<long long>(limit))) {
+                    result.emplace_back(feed_id, feed_title, link, title, enclosure, to_time(pub_ts));
+                }
+                return result;
+            });
+        }
+
+        // "rust async" -> "rust"* "async"*, so what people type never reads as FTS5 syntax
+        static std::string match_expression(std::string_view text)
+        {
+            std::string result;
+            static constexpr std::string_view spaces {" \t\r\n"};
+            for (auto pos = text.find_first_not_of(spaces); pos != std::string_view::npos; pos = text.find_first_not_of(spaces, pos)) {
+                auto const end = std::min(text.find_first_of(spaces, pos), text.size());
+                if (!result.empty()) result += ' ';
+                result += '"';
+                for (auto const c : text.substr(pos, end - pos)) {
+                    if (c == '"') result += '"';
+                    result += c;
+                }
+                result += "\"*";
+                pos = end;
+            }
+            return result;
         }
 
     private:
-        hosting::db::sqlite db_;
+        // An FTS5 index over item titles and descriptions that reads the text from item
+        // itself (external content), kept in step by triggers. It points at item's implicit
+        // rowid, so after a VACUUM run INSERT INTO item_fts(item_fts) VALUES('rebuild').
+        static void ensure_search_index(hosting::db::sqlite &db)
+        {
+            auto const exists = db.query_value<long long>("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'item_fts'").has_value();
+            db.exec("CREATE VIRTUAL TABLE IF NOT EXISTS item_fts USING fts5(title, description, content='item', tokenize='unicode61 remove_diacritics 2')");
+            db.exec("CREATE TRIGGER IF NOT EXISTS item_fts_insert AFTER INSERT ON item BEGIN "
+                "INSERT INTO item_fts (rowid, title, description) VALUES (new.rowid, new.title, new.description); END");
+            db.exec("CREATE TRIGGER IF NOT EXISTS item_fts_delete AFTER DELETE ON item BEGIN "
+                "INSERT INTO item_fts (item_fts, rowid, title, description) VALUES ('delete', old.rowid, old.title, old.description); END");
+            db.exec("CREATE TRIGGER IF NOT EXISTS item_fts_update AFTER UPDATE OF title, description ON item BEGIN "
+                "INSERT INTO item_fts (item_fts, rowid, title, description) VALUES ('delete', old.rowid, old.title, old.description); "
+                "INSERT INTO item_fts (rowid, title, description) VALUES (new.rowid, new.title, new.description); END");
+            if (!exists) {
+                db.exec("INSERT INTO item_fts (item_fts, rank) VALUES ('rank', 'bm25(10.0, 1.0)')");
+                // index what was stored before the search existed
+                db.exec("INSERT INTO item_fts (item_fts) VALUES ('rebuild')");
+            }
+        }
+
+        static long long upsert_feed(hosting::db::sqlite &db, std::string_view url, std::string_view title, std::string_view image_url)
+        {
+            auto const id = db.query_value<long long>(
+                "INSERT INTO feed (url, title, image_url, last_updated) "
+                "VALUES (?, ?, ?, datetime('now')) "
+                "ON CONFLICT(url) DO "
+                "UPDATE SET title=excluded.title, image_url=excluded.image_url, last_updated=datetime('now') "
+                "RETURNING id", url, title, image_url);
+            if (id) {
+                return *id;
+            }
+            return db.query_value<long long>("SELECT id FROM feed WHERE url = ?", url).value_or(-1);
+        }
+
+        static void upsert_item(hosting::db::sqlite &db, long long feed_id, feed::item const &item)
+        {
+            auto const pub_ts = std::chrono::duration_cast<std::chrono::seconds>(item.updated.time_since_epoch()).count();
+            // the date goes into the hash as it did when it was stored as text
+            auto const content_hash = hashing::sha256::hex(std::format("{}\x1f{}\x1f{}\x1f{}\x1f{:%F %T}\x1f{}",
+                feed_id, item.title, item.enclosure, item.description, item.updated, item.image_url));
+            // rows whose content did not change are left alone, so nothing gets written for them
+            db.exec("INSERT INTO item (link, enclosure, feed_id, title, description, pub_ts, image_url, content_hash) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?, ?) "
+                "ON CONFLICT(link) DO UPDATE SET enclosure=excluded.enclosure, feed_id=excluded.feed_id, title=excluded.title, "
+                "description=excluded.description, pub_ts=excluded.pub_ts, image_url=excluded.image_url, content_hash=excluded.content_hash "
+                "WHERE item.content_hash IS NOT excluded.content_hash",
+                {}, item.link, item.enclosure, feed_id, item.title, item.description, static_cast<long long>(pub_ts), item.image_url, std::string_view{content_hash});
+        }
+
+        static std::chrono::system_clock::time_point to_time(long long pub_ts)
+        {
+            return std::chrono::system_clock::time_point{std::chrono::seconds{pub_ts}};
+        }
+
+        hosting::db::database db_;
     };
 }
\ No newline at end of file
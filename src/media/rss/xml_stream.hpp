@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace media::rss {
+    // A push (SAX style) XML tokenizer: bytes go in as they arrive from the network and
+    // open/close/text events come out. It only keeps the token that is still incomplete,
+    // so memory stays flat however long the document is. Enough XML for feeds: elements,
+    // attributes, text, CDATA, entities; comments, processing instructions and doctypes
+    // are skipped, namespaces are left in the names ("itunes:image").
+    struct xml_stream {
+        using attributes_t = std::vector<std::pair<std::string, std::string>>;
+
+        struct handler_t {
+            std::function<void(std::string_view name, attributes_t const &attributes)> open;
+            std::function<void(std::string_view name)> close;
+            std::function<void(std::string_view text)> text;
+        };
+
+        explicit xml_stream(handler_t handler) : handler_{std::move(handler)} {}
+
+        static std::string_view attribute(attributes_t const &attributes, std::string_view name) {
+            for (auto const &[key, value] : attributes) {
+                if (key == name) return value;
+            }
+            return {};
+        }
+
+        void operator()(std::string_view chunk) {
+            buffer_ += chunk;
+            size_t pos {0};
+            while (pos < buffer_.size()) {
+                auto const consumed = buffer_[pos] == '<' ? markup(pos) : text(pos);
+                if (consumed == 0) {
+                    break;
+                }
+                pos += consumed;
+            }
+            buffer_.erase(0, pos);
+        }
+
+        // replaces the predefined and numeric entities in text
+        static std::string decode(std::string_view text) {
+            std::string result;
+            result.reserve(text.size());
+            for (size_t pos = 0; pos < text.size();) {
+                auto const amp = text.find('&', pos);
+                auto const semicolon = amp == std::string_view::npos ? amp : text.find(';', amp);
+                if (semicolon == std::string_view::npos) {
+                    result += text.substr(pos);
+                    break;
+                }
+                result += text.substr(pos, amp - pos);
+                auto const entity = text.substr(amp + 1, semicolon - amp - 1);
+                if (entity == "amp") result += '&';
+                else if (entity == "lt") result += '<';
+                else if (entity == "gt") result += '>';
+                else if (entity == "quot") result += '"';
+                else if (entity == "apos") result += '\'';
+                else if (entity.starts_with('#') && entity.size() > 1) {
+                    auto const hex = entity[1] == 'x' || entity[1] == 'X';
+                    std::uint32_t code {0};
+                    bool valid {entity.size() > (hex ? 2u : 1u)};
+                    for (auto c : entity.substr(hex ? 2 : 1)) {
+                        auto const digit = c >= '0' && c <= '9' ? c - '0'
+                            : hex && c >= 'a' && c <= 'f' ? c - 'a' + 10
+                            : hex && c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                        if (digit < 0 || code > 0x10FFFF) {
+                            valid = false;
+                            break;
+                        }
+                        code = code * (hex ? 16 : 10) + static_cast<std::uint32_t>(digit);
+                    }
+                    if (valid) append_utf8(result, code);
+                    else result += text.substr(amp, semicolon - amp + 1);
+                }
+                else {
+                    // unknown named entity, e.g. &nbsp; from a DTD: leave it alone
+                    result += text.substr(amp, semicolon - amp + 1);
+                }
+                pos = semicolon + 1;
+            }
+            return result;
+        }
+
+    private:
+        static void append_utf8(std::string &out, std::uint32_t code) {
+            if (code < 0x80) {
+                out += static_cast<char>(code);
+            }
+            else if (code < 0x800) {
+                out += static_cast<char>(0xC0 | (code >> 6));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else if (code < 0x10000) {
+                out += static_cast<char>(0xE0 | (code >> 12));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else {
+                out += static_cast<char>(0xF0 | (code >> 18));
+                out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+
+        // character data up to the next tag; an entity cut by the chunk waits for the rest
+        size_t text(size_t pos) {
+            auto end = buffer_.find('<', pos);
+            if (end == std::string::npos) {
+                end = buffer_.size();
+                if (auto const amp = buffer_.rfind('&'); amp != std::string::npos && amp >= pos && buffer_.find(';', amp) == std::string::npos) {
+                    end = amp;
+                }
+            }
+            if (end > pos && handler_.text) {
+                handler_.text(decode(std::string_view{buffer_}.substr(pos, end - pos)));
+            }
+            return end - pos;
+        }
+
+        // one tag, comment, CDATA section or declaration; 0 while it is incomplete
+        size_t markup(size_t pos) {
+            std::string_view const rest {std::string_view{buffer_}.substr(pos)};
+            auto const skip_until = [&rest](std::string_view start, std::string_view terminator) -> size_t {
+                auto const end = rest.find(terminator, start.size());
+                return end == std::string_view::npos ? 0 : end + terminator.size();
+            };
+            static constexpr std::string_view comment {"<!--"}, cdata {"<![CDATA["};
+            // the chunk may end in the middle of "<![CDATA["
+            if ((rest.size() < comment.size() && comment.starts_with(rest)) || (rest.size() < cdata.size() && cdata.starts_with(rest))) {
+                return 0;
+            }
+            if (rest.starts_with(comment)) {
+                return skip_until(comment, "-->");
+            }
+            if (rest.starts_with(cdata)) {
+                auto const end = rest.find("]]>", cdata.size());
+                if (end == std::string_view::npos) {
+                    return 0;
+                }
+                if (handler_.text) {
+                    handler_.text(rest.substr(cdata.size(), end - cdata.size()));
+                }
+                return end + 3;
+            }
+            if (rest.starts_with("<?")) {
+                return skip_until("<?", "?>");
+            }
+            if (rest.starts_with("<!")) {
+                // <!DOCTYPE rss [ ... ]>
+                auto const bracket = rest.find('[');
+                auto const close = rest.find('>');
+                if (bracket != std::string_view::npos && bracket < close) {
+                    return skip_until("<!", "]>");
+                }
+                return close == std::string_view::npos ? 0 : close + 1;
+            }
+            // a tag ends at the first '>' outside of attribute quotes
+            size_t end {1};
+            for (char quote {0}; end < rest.size(); ++end) {
+                if (quote) {
+                    if (rest[end] == quote) quote = 0;
+                }
+                else if (rest[end] == '"' || rest[end] == '\'') {
+                    quote = rest[end];
+                }
+                else if (rest[end] == '>') {
+                    break;
+                }
+            }
+            if (end >= rest.size()) {
+                return 0;
+            }
+            tag(rest.substr(1, end - 1));
+            return end + 1;
+        }
+
+        void tag(std::string_view body) {
+            static constexpr std::string_view spaces {" \t\r\n"};
+            if (body.starts_with('/')) {
+                body.remove_prefix(1);
+                if (handler_.close) handler_.close(body.substr(0, body.find_last_not_of(spaces) + 1));
+                return;
+            }
+            bool const self_closing {body.ends_with('/')};
+            if (self_closing) {
+                body.remove_suffix(1);
+            }
+            auto const name_end = std::min(body.find_first_of(spaces), body.size());
+            auto const name {body.substr(0, name_end)};
+            attributes_.clear();
+            for (auto pos = body.find_first_not_of(spaces, name_end); pos != std::string_view::npos; pos = body.find_first_not_of(spaces, pos)) {
+                auto const equals = body.find('=', pos);
+                if (equals == std::string_view::npos) {
+                    break;
+                }
+                auto key {body.substr(pos, equals - pos)};
+                key = key.substr(0, key.find_last_not_of(spaces) + 1);
+                auto const open = body.find_first_of("\"'", equals);
+                if (open == std::string_view::npos) {
+                    break;
+                }
+                auto const close = body.find(body[open], open + 1);
+                if (close == std::string_view::npos) {
+                    break;
+                }
+                attributes_.emplace_back(std::string{key}, decode(body.substr(open + 1, close - open - 1)));
+                pos = close + 1;
+            }
+            if (handler_.open) handler_.open(name, attributes_);
+            if (self_closing && handler_.close) handler_.close(name);
+        }
+
+        handler_t handler_;
+        std::string buffer_;
+        attributes_t attributes_;
+    };
+}
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <optional>
+#include <stop_token>
 #include <string>
+#include <string_view>
 
 #include "../registrar.hpp"
 #include "../../external/cppgpt/cppgpt.hpp"
@@ -9,14 +13,37 @@
 
 namespace services {
     struct summarize {
+        using delta_sink_t = std::function<void(std::string_view)>;
+        // the streaming form, as kept in the registrar
+        using stream_t = std::function<std::optional<std::string>(std::string_view, delta_sink_t, std::stop_token)>;
+
+        // part of the key of cached summaries: bump prompt_version when the instructions change
+        static constexpr std::string_view model {"grok-2-latest"};
+        static constexpr int prompt_version {1};
+        static constexpr std::string_view instructions {"You are a qualified expert. Summarize the contents of the following in English; avoid technicallities related to it is encoded/presented, go for the essence of the content, including the author. Add your own opinion about it at the end of the report."};
+
         std::string operator()(std::string_view contents) {
             // summarize the contents using gpt
             auto conversation = gpt_->new_conversation();
-            conversation.add_instructions("You are a qualified expert. Summarize the contents of the following in English; avoid technicallities related to it is encoded/presented, go for the essence of the content, including the author. Add your own opinion about it at the end of the report.");
-            auto const response = conversation.sendMessage(contents,[](auto a, auto b, auto c) { return http::fetch{240}.post(a, b, c); });
+            conversation.add_instructions(instructions);
+            auto const response = conversation.sendMessage(contents,[](auto a, auto b, auto c) { return http::fetch{240}.post(a, b, c); }, "user", model);
             return response["choices"][0]["message"]["content"].get_ref<std::string const &>();
         }
+
+        // the summary written into on_delta as it comes; nullopt when stop came first
+        std::optional<std::string> operator()(std::string_view contents, delta_sink_t on_delta, std::stop_token stop) {
+            auto conversation = gpt_->new_conversation();
+            conversation.add_instructions(instructions);
+            bool completed {false};
+            auto text = conversation.sendMessageStream(contents, [&completed, &stop](auto const &url, auto const &body, auto headers, auto sink) {
+                completed = http::fetch{240}.post_stream(url, body, headers, sink, stop);
+            }, std::move(on_delta), "user", model);
+            if (!completed) {
+                return std::nullopt;
+            }
+            return text;
+        }
     private:
         std::shared_ptr<ignacionr::cppgpt> gpt_ = registrar::get<ignacionr::cppgpt>({});
     };
-}
\ No newline at end of file
+}
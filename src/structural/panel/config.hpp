@@ -1,7 +1,11 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
+#include <optional>
 #include <string>
+#include <unordered_map>
+#include <variant>
 #include <vector>
 
 #include <nlohmann/json.hpp>
@@ -12,240 +16,374 @@
 #include "../views/assertion.hpp"
 #include "../views/cached_view.hpp"
 #include "../views/json.hpp"
+#include "../views/refresh_scheduler.hpp"
+#include "../views/streamed_view.hpp"
 
 namespace panel {
+    // The element kinds a panel is compiled into. Everything that can be prepared once
+    // (hosts, producers, tests) is prepared at compile time, so a frame only walks the list.
+    namespace elements {
+        struct ssh_host {
+            hosting::ssh::host::ptr host;
+        };
+
+        // its contents are the elements in (own index, end)
+        struct group {
+            std::string title;
+            size_t end;
+            std::optional<views::refresh_policy> refresh_policy;
+        };
+
+        struct streamed_output {
+            std::string title;
+            views::stream_producer_t producer;
+            std::optional<std::chrono::system_clock::duration> autorefresh;
+        };
+
+        struct json_output {
+            std::string title;
+            std::function<nlohmann::json()> factory;
+            std::function<void(nlohmann::json &)> renderer;
+            std::optional<std::chrono::system_clock::duration> autorefresh;
+        };
+
+        struct input {
+            std::string title;
+            std::string variable;
+            int max_size;
+        };
+
+        struct map_port {
+            std::string title;
+            std::string host_name;
+            int port;
+        };
+
+        struct assertion {
+            std::string title;
+            std::function<bool()> test;
+            std::string host;
+        };
+
+        struct shell_open {
+            std::string title;
+            std::string command;
+        };
+
+        struct shell_execute {
+            std::string title;
+            std::string command;
+            std::string args;
+        };
+    }
+
+    using element_t = std::variant<
+        elements::ssh_host, elements::group, elements::streamed_output, elements::json_output,
+        elements::input, elements::map_port, elements::assertion, elements::shell_open, elements::shell_execute>;
+
     struct config {
-        using fn_t = std::function<void()>;
+        config(nlohmann::json::array_t const &panel, std::shared_ptr<hosting::local::host> localhost,
+            std::optional<views::refresh_policy> refresh_policy = std::nullopt)
+            : localhost_{localhost}, refresh_policy_{refresh_policy}
+        {
+            reusable_t none;
+            compile(panel, none, elements_, sources_);
+        }
 
-        config(nlohmann::json::array_t const &panel, std::shared_ptr<hosting::local::host> localhost)
+        // Recompiles an edited panel. Elements whose JSON did not change keep their compiled
+        // form (and so their hosts and producers); only the others are built again. On error
+        // the previous version stays. Returns how many elements were rebuilt.
+        size_t update(nlohmann::json::array_t const &panel, std::optional<views::refresh_policy> refresh_policy)
         {
-            render_ = render_to_cache(panel, localhost);
+            reusable_t previous;
+            for (size_t i = 0; i < elements_.size(); ++i) {
+                if (!sources_[i].empty()) {
+                    previous.emplace(sources_[i], elements_[i]);
+                }
+            }
+            std::vector<element_t> elements;
+            std::vector<std::string> sources;
+            auto const rebuilt = compile(panel, previous, elements, sources);
+            elements_ = std::move(elements);
+            sources_ = std::move(sources);
+            refresh_policy_ = refresh_policy;
+            return rebuilt;
         }
 
-        void render() const noexcept {
-            render_();
+        // one pass over the flat element list; closed groups are skipped by jumping to their end
+        void render() noexcept {
+            views::scoped_refresh_policy policy{refresh_policy_};
+            open_groups_.clear();
+            for (size_t index = 0; index < elements_.size();) {
+                while (!open_groups_.empty() && open_groups_.back().end == index) {
+                    close_group();
+                }
+                index = std::visit([this, index](auto const &element) { return render_element(element, index); }, elements_[index]);
+            }
+            while (!open_groups_.empty()) {
+                close_group();
+            }
         }
 
     private:
-        fn_t render_to_cache(nlohmann::json const &panel, std::shared_ptr<hosting::local::host> localhost) 
+        struct open_group_t {
+            size_t end;
+            bool pushed_policy;
+        };
+
+        // compiled elements of the previous version, by the JSON they came from
+        using reusable_t = std::unordered_multimap<std::string, element_t>;
+
+        // appends the compiled panel to elements; sources holds each element's JSON, empty for groups
+        size_t compile(nlohmann::json const &panel, reusable_t &reusable, std::vector<element_t> &elements, std::vector<std::string> &sources)
         {
-            std::unordered_map<std::string_view, std::function<fn_t(nlohmann::json const &)>> renderers {
-                {"ssh-host", [localhost, this] (nlohmann::json const &element) -> fn_t {
-                    // render ssh host
-                    auto host = hosting::ssh::host::by_name(element.at("name").get<std::string>());
-                    return [host, localhost, this]{ssh_screen_.render(host, localhost);};
-                }},
-                {"group", [localhost, this] (nlohmann::json const &element) -> fn_t {
-                    fn_t content_render = render_to_cache(element.at("contents"), localhost);
-                    return [content_render, title = element.at("title").get<std::string>()]{
-                        if (ImGui::CollapsingHeader(title.c_str())) {
-                            ImGui::Indent();
-                            content_render();
-                            ImGui::Unindent();
-                        }
-                    };
-                }},
-                {"container-command-output", [localhost] (nlohmann::json const &element) -> fn_t {
-                    auto const host_name = element.at("host").get<std::string>();
-                    auto const container_name = element.at("container").get<std::string>();
-                    auto const command = element.at("command").get<std::string>();
-                    auto const title = element.at("title").get<std::string>();
-                    return [command, host_name, container_name, localhost, title]{
-                        views::cached_view<std::string>(title,
-                        [host_name, command, container_name, localhost]{ return hosting::ssh::host::by_name(host_name)->docker()
-                        .execute_command(command, container_name, localhost, false);},
-                        [](std::string const &output) {
-                            ImGui::TextWrapped("%s", output.c_str());
-                        });
-                    };
-                }},
-                {"ssh-command-output", [localhost] (nlohmann::json const &element) -> fn_t {
-                    auto const host_name = element.at("host").get<std::string>();
-                    auto const command = element.at("command").get<std::string>();
-                    auto const title = element.at("title").get<std::string>();
-                    return [command, host_name, localhost, title]{
-                        views::cached_view<std::string>(title,
-                        [host_name, command, localhost]{ return hosting::ssh::host::by_name(host_name)->execute_command(command, localhost, false);},
-                        [](std::string const &output) {
-                            ImGui::TextWrapped("%s", output.c_str());
-                        });
-                    };
-                }},
-                {"command-output", [localhost] (nlohmann::json const &element) -> fn_t {
-                    auto const command = element.at("command").get<std::string>();
-                    auto const title = element.at("title").get<std::string>();
-                    auto const view_type = element.contains("view") ? element.at("view").get<std::string>() : "text";
-                    std::optional<std::chrono::system_clock::duration> autorefresh_seconds = std::nullopt;
-                    if (element.contains("auto-refresh")) {
-                        autorefresh_seconds = std::chrono::seconds(element.at("auto-refresh").get<int>());
-                    }
-                    if (view_type == "json") {
-                        return [command, localhost, title, autorefresh_seconds]{
-                            views::cached_view<nlohmann::json>(title,
-                            [command, localhost] {
-                                auto const output {localhost->execute_command(command)}; 
-                                nlohmann::json ret;
-                                try {
-                                    ret = nlohmann::json::parse(output);
-                                }
-                                catch(nlohmann::json::parse_error const &e) {
-                                    ret = nlohmann::json::object();
-                                    ret["error"] = e.what();
-                                    ret["received"] = output;
-                                }
-                                return ret;
-                            },
-                            [](nlohmann::json const &output) {
-                                static views::json jv;
-                                jv.render(output);
-                            },
-                            false,
-                            autorefresh_seconds);
-                        };
+            size_t rebuilt {0};
+            for (auto const &element : panel) {
+                auto const type = element.at("type").get<std::string>();
+                if (type == "group") {
+                    auto const index = elements.size();
+                    std::optional<views::refresh_policy> refresh_policy;
+                    if (element.contains("background-refresh")) {
+                        refresh_policy = views::refresh_policy::from_json(element.at("background-refresh"));
                     }
-                    return [command, localhost, title, autorefresh_seconds]{
-                        views::cached_view<std::string>(title,
+                    elements.emplace_back(elements::group{element.at("title").get<std::string>(), 0, refresh_policy});
+                    sources.emplace_back();
+                    rebuilt += compile(element.at("contents"), reusable, elements, sources);
+                    std::get<elements::group>(elements[index]).end = elements.size();
+                    continue;
+                }
+                auto source {element.dump()};
+                if (auto it = reusable.find(source); it != reusable.end()) {
+                    elements.push_back(std::move(it->second));
+                    reusable.erase(it);
+                }
+                else if (auto compiled = compile_element(type, element)) {
+                    elements.push_back(std::move(*compiled));
+                    ++rebuilt;
+                }
+                else {
+                    continue;
+                }
+                sources.push_back(std::move(source));
+            }
+            return rebuilt;
+        }
+
+        std::optional<element_t> compile_element(std::string const &type, nlohmann::json const &element)
+        {
+            auto const localhost {localhost_};
+            if (type == "ssh-host") {
+                return elements::ssh_host{hosting::ssh::host::by_name(element.at("name").get<std::string>())};
+            }
+            if (type == "container-command-output") {
+                auto const host_name = element.at("host").get<std::string>();
+                auto const container_name = element.at("container").get<std::string>();
+                auto const command = element.at("command").get<std::string>();
+                return elements::streamed_output{element.at("title").get<std::string>(),
+                    [host_name, command, container_name, localhost](views::chunk_sink_t const &sink){
+                        hosting::ssh::host::by_name(host_name)->docker()
+                        .stream_command(command, container_name, localhost, sink, false);
+                    }, std::nullopt};
+            }
+            if (type == "ssh-command-output") {
+                auto const host_name = element.at("host").get<std::string>();
+                auto const command = element.at("command").get<std::string>();
+                return elements::streamed_output{element.at("title").get<std::string>(),
+                    [host_name, command, localhost](views::chunk_sink_t const &sink){
+                        hosting::ssh::host::by_name(host_name)->stream_command(command, localhost, sink, false);
+                    }, std::nullopt};
+            }
+            if (type == "command-output") {
+                auto const command = element.at("command").get<std::string>();
+                auto const title = element.at("title").get<std::string>();
+                auto const view_type = element.contains("view") ? element.at("view").get<std::string>() : "text";
+                std::optional<std::chrono::system_clock::duration> autorefresh_seconds = std::nullopt;
+                if (element.contains("auto-refresh")) {
+                    autorefresh_seconds = std::chrono::seconds(element.at("auto-refresh").get<int>());
+                }
+                if (view_type == "json") {
+                    return elements::json_output{title,
                         [command, localhost] {
-                            return localhost->execute_command(command);
-                        },
-                        [](std::string const &output) {
-                            ImGui::TextWrapped("%s", output.c_str());
-                        },
-                        false,
-                        autorefresh_seconds);
-                    };
-                }},
-                {"input", [localhost, this] (nlohmann::json const &element) -> fn_t {
-                    auto const title = element.at("title").get<std::string>();
-                    auto const variable_name = element.at("variable").get<std::string>();
-                    auto const max_size = element.contains("max-size") ? element.at("max-size").get<int>() : 256;
-                    return [title, variable_name, localhost, max_size, this] {
-                        auto &str {input_values_[ImGui::GetID(&variable_name)]};
-                        if (str.reserve(max_size); ImGui::InputText(title.c_str(), str.data(), max_size)) {
-                            str = str.data();
-                            localhost->set_env_variable(variable_name, str);
-                        }
-                    };
-                }},
-                {"map-port", [localhost, this] (nlohmann::json const &element) -> fn_t {
-                    auto const host_name = element.at("host").get<std::string>();
-                    auto const port = element.at("port").get<int>();
-                    auto const title = element.at("title").get<std::string>();
-                    return [host_name, port, localhost, title, this]{
-                        if (ImGui::Button(title.c_str())) {
-                            mappings_.push_back(std::make_unique<hosting::local::mapping>(port, host_name, localhost));
-                        }
-                    };
-                }},
-                {"assertion", [localhost](nlohmann::json const &element) -> fn_t {
-                    // render assertion
-                    std::function<bool()> test = []{ return false; };
-                    auto const test_element = element.at("test").get<nlohmann::json::object_t>();
-                    auto const type_name = test_element.at("type").get<std::string>();
-                    std::unordered_map<std::string, fn_t> tests {
-                        {"docker-container-running", [&test_element, localhost, &test]{
-                            auto const container_name = test_element.at("container").get<std::string>();
-                            auto const host_name = test_element.at("host").get<std::string>();
-                            test = [container_name, host_name, localhost]{
-                                return hosting::ssh::host::by_name(host_name)->docker()
-                                .is_container_running(container_name, localhost);
-                            };
-                        }},
-                        {"docker-process-running", [&test_element, localhost, &test]{
-                            auto const process_name = test_element.at("process").get<std::string>();
-                            auto const host_name = test_element.at("host").get<std::string>();
-                            auto const container_name = test_element.at("container").get<std::string>();
-                            test = [process_name, host_name, container_name, localhost] {
-                                return hosting::ssh::host::by_name(host_name)->docker()
-                                .is_process_running(container_name, process_name, localhost);
-                            };
-                        }},
-                        {"container-command", [&test_element, localhost, &test]{
-                            auto const host_name = test_element.at("host").get<std::string>();
-                            auto const container_name = test_element.at("container").get<std::string>();
-                            auto const command = test_element.at("command").get<std::string>();
-                            std::function<bool(std::string_view)> string_test = [](std::string_view result){ return !result.empty(); };
-                            if (test_element.contains("should-contain")) {
-                                auto content = test_element.at("should-contain").get<std::string>();
-                                string_test = [content](std::string_view actual) -> bool {
-                                    return actual.find(content) != std::string::npos;
-                                };
+                            auto const output {localhost->execute_command(command)};
+                            nlohmann::json ret;
+                            try {
+                                ret = nlohmann::json::parse(output);
                             }
-                            else if (test_element.contains("should-not-contain")) {
-                                auto content = test_element.at("should-not-contain").get<std::string>();
-                                string_test = [content](std::string_view actual) -> bool {
-                                    return actual.find(content) == std::string::npos;
-                                };
+                            catch(nlohmann::json::parse_error const &e) {
+                                ret = nlohmann::json::object();
+                                ret["error"] = e.what();
+                                ret["received"] = output;
                             }
-                            test = [command, host_name, container_name, localhost, string_test]{
-                                return string_test(hosting::ssh::host::by_name(host_name)->docker()
-                                .execute_command(command, container_name, localhost, false));
-                            };
-                        }},
-                        {"ssh-command", [&test_element, localhost, &test]{
-                            auto const host_name = test_element.at("host").get<std::string>();
-                            auto const command = test_element.at("command").get<std::string>();
-                            std::function<bool(std::string_view)> string_test = [](std::string_view result){ return !result.empty(); };
-                            if (test_element.contains("should-contain")) {
-                                auto content = test_element.at("should-contain").get<std::string>();
-                                string_test = [content](std::string_view actual) -> bool {
-                                    return actual.find(content) != std::string::npos;
-                                };
-                            }
-                            else if (test_element.contains("should-not-contain")) {
-                                auto content = test_element.at("should-not-contain").get<std::string>();
-                                string_test = [content](std::string_view actual) -> bool {
-                                    return actual.find(content) == std::string::npos;
-                                };
-                            }
-                            test = [command, host_name, localhost, string_test]{
-                                return string_test(hosting::ssh::host::by_name(host_name)->execute_command(command, localhost, false));
-                            };
-                        }}
-                    };
-                    if (auto it = tests.find(type_name); it != tests.end()) {
-                        it->second();
-                    }
-                    return [title = element.at("title").get<std::string>(), test]{
-                        views::assertion(title, test);
-                    };
-                }},
-                {"shell-open", [](nlohmann::json const &element) {
-                    // execute locally
-                    auto command = element.at("command").get<std::string>();
-                    return [command, title = element.at("title").get<std::string>()]{
-                        if (ImGui::Button(title.c_str())) {
-                            ShellExecuteA(nullptr, "open", command.c_str(), nullptr, nullptr, SW_SHOW);
-                        }
+                            return ret;
+                        },
+                        [](nlohmann::json const &output) {
+                            static views::json jv;
+                            jv.render(output);
+                        },
+                        autorefresh_seconds};
+                }
+                return elements::streamed_output{title,
+                    [command, localhost](views::chunk_sink_t const &sink) {
+                        localhost->stream_command(command, sink);
+                    },
+                    autorefresh_seconds};
+            }
+            if (type == "input") {
+                return elements::input{element.at("title").get<std::string>(), element.at("variable").get<std::string>(),
+                    element.contains("max-size") ? element.at("max-size").get<int>() : 256};
+            }
+            if (type == "map-port") {
+                return elements::map_port{element.at("title").get<std::string>(), element.at("host").get<std::string>(),
+                    element.at("port").get<int>()};
+            }
+            if (type == "assertion") {
+                auto const test_element = element.at("test").get<nlohmann::json::object_t>();
+                return elements::assertion{element.at("title").get<std::string>(), compile_test(test_element),
+                    test_element.contains("host") ? test_element.at("host").get<std::string>() : std::string{}};
+            }
+            if (type == "shell-open") {
+                return elements::shell_open{element.at("title").get<std::string>(), element.at("command").get<std::string>()};
+            }
+            if (type == "shell-execute") {
+                return elements::shell_execute{element.at("title").get<std::string>(), element.at("command").get<std::string>(),
+                    element.contains("args") ? element.at("args").get<std::string>() : std::string{}};
+            }
+            return std::nullopt;
+        }
+
+        std::function<bool()> compile_test(nlohmann::json::object_t const &test_element)
+        {
+            auto const localhost {localhost_};
+            auto const type_name = test_element.at("type").get<std::string>();
+            auto string_test = [&test_element]() -> std::function<bool(std::string_view)> {
+                if (test_element.contains("should-contain")) {
+                    auto content = test_element.at("should-contain").get<std::string>();
+                    return [content](std::string_view actual) -> bool {
+                        return actual.find(content) != std::string::npos;
                     };
-                }},
-                {"shell-execute", [](nlohmann::json const &element) {
-                    // execute locally
-                    auto command = element.at("command").get<std::string>();
-                    auto args = element.contains("args") ? element.at("args").get<std::string>() : std::string{};
-                    return [command, args, title = element.at("title").get<std::string>()]{
-                        if (ImGui::Button(title.c_str())) {
-                            ShellExecuteA(nullptr, nullptr, command.c_str(), args.c_str(), nullptr, SW_SHOW);
-                        }
+                }
+                if (test_element.contains("should-not-contain")) {
+                    auto content = test_element.at("should-not-contain").get<std::string>();
+                    return [content](std::string_view actual) -> bool {
+                        return actual.find(content) == std::string::npos;
                     };
-                }}
+                }
+                return [](std::string_view result){ return !result.empty(); };
             };
+            if (type_name == "docker-container-running") {
+                auto const container_name = test_element.at("container").get<std::string>();
+                auto const host_name = test_element.at("host").get<std::string>();
+                return [container_name, host_name, localhost]{
+                    return hosting::ssh::host::by_name(host_name)->docker()
+                    .is_container_running(container_name, localhost);
+                };
+            }
+            if (type_name == "docker-process-running") {
+                auto const process_name = test_element.at("process").get<std::string>();
+                auto const host_name = test_element.at("host").get<std::string>();
+                auto const container_name = test_element.at("container").get<std::string>();
+                return [process_name, host_name, container_name, localhost] {
+                    return hosting::ssh::host::by_name(host_name)->docker()
+                    .is_process_running(container_name, process_name, localhost);
+                };
+            }
+            if (type_name == "container-command") {
+                auto const host_name = test_element.at("host").get<std::string>();
+                auto const container_name = test_element.at("container").get<std::string>();
+                auto const command = test_element.at("command").get<std::string>();
+                return [command, host_name, container_name, localhost, string_test = string_test()]{
+                    return string_test(hosting::ssh::host::by_name(host_name)->docker()
+                    .execute_command(command, container_name, localhost, false));
+                };
+            }
+            if (type_name == "ssh-command") {
+                auto const host_name = test_element.at("host").get<std::string>();
+                auto const command = test_element.at("command").get<std::string>();
+                return [command, host_name, localhost, string_test = string_test()]{
+                    return string_test(hosting::ssh::host::by_name(host_name)->execute_command(command, localhost, false));
+                };
+            }
+            return []{ return false; };
+        }
 
-            fn_t result = []{};
-            for (auto const &element : panel) {
-                auto type = element.at("type").get<std::string>();
-                if (auto it = renderers.find(type); it != renderers.end()) {
-                    auto previous_result = result;
-                    auto action = it->second(element);
-                    result = [previous_result, action] { previous_result(); action(); };
-                }
+        void close_group() {
+            ImGui::Unindent();
+            if (open_groups_.back().pushed_policy) {
+                views::refresh_scheduler::instance().pop_policy();
+            }
+            open_groups_.pop_back();
+        }
+
+        // each returns the index of the next element to render
+        size_t render_element(elements::group const &element, size_t index) {
+            if (!ImGui::CollapsingHeader(element.title.c_str())) {
+                return element.end;
+            }
+            if (element.refresh_policy) {
+                views::refresh_scheduler::instance().push_policy(*element.refresh_policy);
+            }
+            open_groups_.push_back({element.end, element.refresh_policy.has_value()});
+            ImGui::Indent();
+            return index + 1;
+        }
+
+        size_t render_element(elements::ssh_host const &element, size_t index) {
+            ssh_screen_.render(element.host, localhost_);
+            return index + 1;
+        }
+
+        size_t render_element(elements::streamed_output const &element, size_t index) {
+            views::streamed_view(element.title, element.producer, false, element.autorefresh);
+            return index + 1;
+        }
+
+        size_t render_element(elements::json_output const &element, size_t index) {
+            views::cached_view<nlohmann::json>(element.title, element.factory, element.renderer, false, element.autorefresh);
+            return index + 1;
+        }
+
+        size_t render_element(elements::input const &element, size_t index) {
+            auto &str {input_values_[ImGui::GetID(element.variable.c_str())]};
+            if (str.reserve(element.max_size); ImGui::InputText(element.title.c_str(), str.data(), element.max_size)) {
+                str = str.data();
+                localhost_->set_env_variable(element.variable, str);
+            }
+            return index + 1;
+        }
+
+        size_t render_element(elements::map_port const &element, size_t index) {
+            if (ImGui::Button(element.title.c_str())) {
+                mappings_.push_back(std::make_unique<hosting::local::mapping>(element.port, element.host_name, localhost_));
+            }
+            return index + 1;
+        }
+
+        size_t render_element(elements::assertion const &element, size_t index) {
+            views::assertion(element.title, element.test, element.host);
+            return index + 1;
+        }
+
+        size_t render_element(elements::shell_open const &element, size_t index) {
+            if (ImGui::Button(element.title.c_str())) {
+                ShellExecuteA(nullptr, "open", element.command.c_str(), nullptr, nullptr, SW_SHOW);
+            }
+            return index + 1;
+        }
+
+        size_t render_element(elements::shell_execute const &element, size_t index) {
+            if (ImGui::Button(element.title.c_str())) {
+                ShellExecuteA(nullptr, nullptr, element.command.c_str(), element.args.c_str(), nullptr, SW_SHOW);
             }
-            return result;
+            return index + 1;
         }
 
-        std::function<void()> render_;
+        std::shared_ptr<hosting::local::host> localhost_;
+        std::optional<views::refresh_policy> refresh_policy_;
+        std::vector<element_t> elements_;
+        std::vector<std::string> sources_;
+        std::vector<open_group_t> open_groups_;
         hosting::ssh::screen ssh_screen_;
         std::vector<std::unique_ptr<hosting::local::mapping>> mappings_;
         std::unordered_map<ImGuiID, std::string> input_values_;
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <system_error>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace panel {
+    // Reports the panel files that changed since the last call. It is polled once per
+    // frame from the UI thread, so it never blocks: inotify on Linux, and a modification
+    // time scan (at most once per scan_interval) everywhere else.
+    struct watcher {
+        watcher(std::filesystem::path directory, std::string extension = ".json")
+            : directory_{std::move(directory)}, extension_{std::move(extension)}
+        {
+#if defined(__linux__)
+            fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd_ >= 0 && inotify_add_watch(fd_, directory_.string().c_str(),
+                    IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE) < 0) {
+                close(fd_);
+                fd_ = -1;
+            }
+#endif
+            scan(true);
+        }
+
+        watcher(watcher const &) = delete;
+
+        ~watcher() {
+#if defined(__linux__)
+            if (fd_ >= 0) {
+                close(fd_);
+            }
+#endif
+        }
+
+        // changed, added and removed files since the previous call
+        std::set<std::filesystem::path> poll() {
+            std::set<std::filesystem::path> changed;
+#if defined(__linux__)
+            if (fd_ >= 0) {
+                alignas(inotify_event) char buffer[4096];
+                for (;;) {
+                    auto const length = read(fd_, buffer, sizeof(buffer));
+                    if (length <= 0) {
+                        break;
+                    }
+                    for (char *ptr = buffer; ptr < buffer + length;) {
+                        auto const event = reinterpret_cast<inotify_event const *>(ptr);
+                        if (event->len > 0) {
+                            std::filesystem::path const path {directory_ / event->name};
+                            if (path.extension() == extension_) {
+                                changed.insert(path);
+                            }
+                        }
+                        ptr += sizeof(inotify_event) + event->len;
+                    }
+                }
+                return changed;
+            }
+#endif
+            auto const now = std::chrono::steady_clock::now();
+            if (now - last_scan_ < scan_interval) {
+                return changed;
+            }
+            last_scan_ = now;
+            return scan(false);
+        }
+
+    private:
+        static constexpr std::chrono::seconds scan_interval{1};
+
+        std::set<std::filesystem::path> scan(bool initial) {
+            std::set<std::filesystem::path> changed;
+            std::map<std::filesystem::path, std::filesystem::file_time_type> current;
+            std::error_code ec;
+            for (auto const &entry : std::filesystem::directory_iterator{directory_, ec}) {
+                if (entry.is_regular_file(ec) && entry.path().extension() == extension_) {
+                    current[entry.path()] = entry.last_write_time(ec);
+                }
+            }
+            if (!initial) {
+                for (auto const &[path, time] : current) {
+                    if (auto it = mtimes_.find(path); it == mtimes_.end() || it->second != time) {
+                        changed.insert(path);
+                    }
+                }
+                for (auto const &[path, time] : mtimes_) {
+                    if (!current.contains(path)) {
+                        changed.insert(path);
+                    }
+                }
+            }
+            mtimes_ = std::move(current);
+            return changed;
+        }
+
+        std::filesystem::path directory_;
+        std::string extension_;
+        std::map<std::filesystem::path, std::filesystem::file_time_type> mtimes_;
+        std::chrono::steady_clock::time_point last_scan_{std::chrono::steady_clock::now()};
+#if defined(__linux__)
+        int fd_{-1};
+#endif
+    };
+}
@@ -1,13 +1,21 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <format>
 #include <functional>
-#include <queue>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <optional>
+#include <vector>
 #include <imgui.h>
+#include <nlohmann/json.hpp>
 #include <utf8h/utf8.h>
 
 namespace views 
@@ -16,19 +24,26 @@ namespace views
     {
         bool value{false};
         bool waiting{false};
+        bool timed_out{false};
         std::optional<std::string> exception;
+        std::chrono::steady_clock::duration elapsed{};
+        std::chrono::system_clock::time_point checked{};
         operator bool() const {
             if (exception) return false;
             return value;
         }
         auto load(std::function<bool()> action) {
             exception.reset();
+            timed_out = false;
+            auto const started {std::chrono::steady_clock::now()};
             try {
                 value = action();
             }
             catch (std::exception const &e) {
                 exception = e.what();
             }
+            elapsed = std::chrono::steady_clock::now() - started;
+            checked = std::chrono::system_clock::now();
             waiting = false;
         }
     };
@@ -49,47 +64,238 @@ namespace views
         quitting() = value;
     }
     
-    void assertion(std::string_view title, std::function<bool()> assertion) 
+    // Runs assertion tests on up to options_t::workers threads at a time, with at most
+    // per_host of them against the same host. Tests re-run every interval while they are
+    // on screen. A test that exceeds the timeout is reported as timed out right away, but
+    // keeps its worker and host slot until it returns, so hung tests never add threads.
+    struct assertion_engine
     {
-        static std::unordered_map<int, state_t> states;
-        static std::queue<std::function<void()>> updates;
-        static std::thread update_thread([] {
-            while (!quitting()) {
-                if (updates.empty()) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                    continue;
+        struct options_t
+        {
+            size_t workers{8};
+            size_t per_host{2};
+            std::chrono::seconds interval{60};
+            std::chrono::seconds timeout{30};
+
+            // reads the "assertions" section of beatograph.json, e.g.
+            // {"workers": 8, "per-host": 2, "interval-seconds": 60, "timeout-seconds": 30}
+            static options_t from_json(nlohmann::json const &node)
+            {
+                options_t result;
+                if (node.contains("workers")) result.workers = std::max<size_t>(1, node.at("workers").get<size_t>());
+                if (node.contains("per-host")) result.per_host = std::max<size_t>(1, node.at("per-host").get<size_t>());
+                if (node.contains("interval-seconds")) result.interval = std::chrono::seconds{node.at("interval-seconds").get<int>()};
+                if (node.contains("timeout-seconds")) result.timeout = std::chrono::seconds{node.at("timeout-seconds").get<int>()};
+                return result;
+            }
+        };
+
+        struct entry_t
+        {
+            // guarded by the engine mutex; replaced on every call, so an edited panel
+            // that keeps its titles runs the new tests
+            std::function<bool()> test;
+            std::string host;
+            std::mutex mutex;
+            state_t state; // guarded by mutex
+            // guarded by the engine mutex
+            bool busy{false};
+            bool timed_out{false};
+            std::chrono::steady_clock::time_point started;
+        };
+        using entry_ptr = std::shared_ptr<entry_t>;
+
+        static assertion_engine &instance()
+        {
+            // never destroyed: tests may still be running at exit
+            static auto engine = new assertion_engine;
+            return *engine;
+        }
+
+        void configure(options_t options)
+        {
+            std::lock_guard lock{mutex_};
+            options_ = options;
+            cv_.notify_all();
+        }
+
+        entry_ptr entry(ImGuiID id, std::string_view host, std::function<bool()> const &test)
+        {
+            std::lock_guard lock{mutex_};
+            auto &entry {entries_[id]};
+            if (!entry)
+            {
+                entry = std::make_shared<entry_t>();
+                entry->state.waiting = true;
+            }
+            entry->test = test;
+            entry->host = host;
+            return entry;
+        }
+
+        bool due(entry_ptr const &entry) const
+        {
+            std::lock_guard lock{mutex_};
+            if (entry->busy)
+            {
+                return false;
+            }
+            std::lock_guard state_lock{entry->mutex};
+            return entry->state.checked == std::chrono::system_clock::time_point{} ||
+                   entry->state.checked + options_.interval < std::chrono::system_clock::now();
+        }
+
+        // urgent entries (a click) jump the queue
+        void schedule(entry_ptr const &entry, bool urgent = false)
+        {
+            {
+                std::lock_guard lock{mutex_};
+                if (entry->busy)
+                {
+                    return;
+                }
+                entry->busy = true;
+                if (urgent)
+                {
+                    queue_.push_front(entry);
+                }
+                else
+                {
+                    queue_.push_back(entry);
+                }
+                if (!dispatcher_started_)
+                {
+                    dispatcher_started_ = true;
+                    std::thread([this] { dispatch(); }).detach();
+                }
+            }
+            {
+                std::lock_guard state_lock{entry->mutex};
+                entry->state.waiting = true;
+            }
+            cv_.notify_all();
+        }
+
+    private:
+        assertion_engine() = default;
+
+        void dispatch()
+        {
+            std::unique_lock lock{mutex_};
+            while (!quitting())
+            {
+                auto const now {std::chrono::steady_clock::now()};
+                // watchdog
+                for (auto it = running_.begin(); it != running_.end();)
+                {
+                    auto const &entry {*it};
+                    if (entry->timed_out || now - entry->started <= options_.timeout)
+                    {
+                        ++it;
+                        continue;
+                    }
+                    entry->timed_out = true;
+                    {
+                        std::lock_guard state_lock{entry->mutex};
+                        entry->state.value = false;
+                        entry->state.waiting = false;
+                        entry->state.timed_out = true;
+                        entry->state.exception = std::format("timed out after {}s", options_.timeout.count());
+                        entry->state.elapsed = now - entry->started;
+                        entry->state.checked = std::chrono::system_clock::now();
+                    }
+                    ++it;
+                }
+                // start whatever fits within the worker and per-host limits
+                for (auto it = queue_.begin(); it != queue_.end() && active_ < options_.workers;)
+                {
+                    auto &host_count {per_host_[(*it)->host]};
+                    if (!(*it)->host.empty() && host_count >= options_.per_host)
+                    {
+                        ++it;
+                        continue;
+                    }
+                    ++host_count;
+                    ++active_;
+                    auto entry {*it};
+                    it = queue_.erase(it);
+                    entry->timed_out = false;
+                    entry->started = now;
+                    running_.push_back(entry);
+                    std::thread([this, entry, test = entry->test, host = entry->host] { run(entry, test, host); }).detach();
                 }
-                updates.front()();
-                updates.pop();
+                cv_.wait_for(lock, std::chrono::milliseconds{250});
+            }
+        }
+
+        // test and host are the ones the run started with, whatever the panel says meanwhile
+        void run(entry_ptr entry, std::function<bool()> test, std::string host)
+        {
+            state_t result;
+            result.load(test);
+            bool publish;
+            {
+                std::lock_guard lock{mutex_};
+                --per_host_[host];
+                --active_;
+                std::erase(running_, entry);
+                publish = !entry->timed_out;
+                entry->busy = false;
+            }
+            if (publish)
+            {
+                std::lock_guard state_lock{entry->mutex};
+                entry->state = result;
+            }
+            cv_.notify_all();
+            if (publish)
+            {
+                state_updated()(result);
             }
-        });
-        static bool dettached {false};
-        if (!dettached) {
-            update_thread.detach();
-            dettached = true;
         }
+
+        mutable std::mutex mutex_;
+        std::condition_variable cv_;
+        options_t options_;
+        std::unordered_map<ImGuiID, entry_ptr> entries_;
+        std::deque<entry_ptr> queue_;
+        std::vector<entry_ptr> running_;
+        std::unordered_map<std::string, size_t> per_host_;
+        size_t active_{0};
+        bool dispatcher_started_{false};
+    };
+
+    // host, when given, is used to limit how many tests run against the same machine
+    void assertion(std::string_view title, std::function<bool()> assertion, std::string_view host = {}) 
+    {
+        auto &engine {assertion_engine::instance()};
         auto id = ImGui::GetID(title.data(), title.data() + title.size());
-        ImGui::PushID(id);
-        // is the assertion already in the map?
-        if (states.find(id) == states.end()) {
-            // if not, add it
-            states[id].waiting = true;
-            updates.push([id, assertion] {
-                states[id].load([assertion] { return assertion(); });
-                state_updated()(states[id]);
-            });
+        auto const entry {engine.entry(id, host, assertion)};
+        if (engine.due(entry)) {
+            engine.schedule(entry);
         }
-        // get the state
-        auto &state{states[id]};
+        state_t state;
+        {
+            std::lock_guard lock{entry->mutex};
+            state = entry->state;
+        }
+        ImGui::PushID(id);
         // set the color
         auto const color{state.waiting ? ImVec4(128, 128, 128, 128) :  (state ? ImVec4(0, 255, 0, 255) : ImVec4(255, 0, 0, 255))};
         ImGui::BeginDisabled(state.waiting);
         // render the assertion
         if (ImGui::Checkbox("", &state.value)) {
-            state.load([&]{ return assertion(); });
+            engine.schedule(entry, true);
         }
         ImGui::SameLine();
         ImGui::TextColored(color, "%s", title.data());
+        if (state.checked != std::chrono::system_clock::time_point{}) {
+            ImGui::SameLine();
+            auto const age {std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - state.checked)};
+            ImGui::TextDisabled("%lld ms, %llds ago",
+                static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(state.elapsed).count()),
+                static_cast<long long>(age.count()));
+        }
         if (state.exception) {
             ImGui::SameLine();
             ImGui::TextColored(ImVec4(255, 0, 0, 255), "Error: %s", state.exception->c_str());
@@ -97,4 +303,4 @@ namespace views
         ImGui::EndDisabled();
         ImGui::PopID();
     }
-} // namespace views
\ No newline at end of file
+} // namespace views
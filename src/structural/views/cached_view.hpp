@@ -1,21 +1,37 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
-#include <expected>
+#include <format>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
-#include <thread>
 #include <unordered_map>
 
 #include <imgui.h>
 
 #pragma execution_character_set(push, "utf-8")
 #include "../../../external/IconsMaterialDesign.h"
+#include "refresh_scheduler.hpp"
+#include "snapshot_store.hpp"
+#include "view_executor.hpp"
 
 namespace views {
+    // compact age for the badge next to a stale value: 12s, 5m, 3h, 2d
+    inline std::string format_age(std::chrono::system_clock::duration age) {
+        auto const seconds {std::chrono::duration_cast<std::chrono::seconds>(age).count()};
+        if (seconds < 60) return std::format("{}s", std::max<long long>(seconds, 0));
+        if (seconds < 3600) return std::format("{}m", seconds / 60);
+        if (seconds < 86400) return std::format("{}h", seconds / 3600);
+        return std::format("{}d", seconds / 86400);
+    }
+
+    // Renders the result of factory, reloading it in the background. While a reload runs
+    // (or after it fails) the previous value stays on screen with its age, and for types
+    // with snapshot_traits the last good value is restored from disk on startup.
     template<typename cached_t>
     void cached_view(
         std::string const &name, std::function<cached_t()> const &factory, 
@@ -24,62 +40,115 @@ namespace views {
         std::optional<std::chrono::system_clock::duration> autorefresh_seconds = std::nullopt,
         std::function<void(std::string_view)> const &on_error = {})
     {
-        using cached_item_t = std::expected<cached_t, std::string>;
-        using ptr_t = std::shared_ptr<cached_item_t>;
-        using envelope_t = std::pair<std::atomic<ptr_t>, std::chrono::system_clock::time_point>;
+        using traits_t = snapshot_traits<cached_t>;
+        // reload jobs hold on to their entry, so the map can change while they run
+        struct entry_t {
+            std::atomic<std::shared_ptr<cached_t>> value;
+            std::atomic<std::shared_ptr<std::string const>> error;
+            std::atomic<std::chrono::system_clock::time_point> updated;
+            std::atomic<bool> loading{false};
+            bool stale{false};
+            std::chrono::system_clock::time_point requested;
+        };
 
-        static std::unordered_map<int, envelope_t> cache;
+        static std::mutex cache_mutex;
+        static std::unordered_map<ImGuiID, std::shared_ptr<entry_t>> cache;
 
         auto const item_id {ImGui::GetID(name.c_str())};
-        auto reload = [&name, &factory, item_id, on_error] {
-                cache[item_id].second = std::chrono::system_clock::now();
-                cache[item_id].first.store(std::make_shared<cached_item_t>(std::unexpected("Loading...")));
-                std::thread([factory, item_id, on_error] {
-                    ptr_t contents;
+        std::shared_ptr<entry_t> entry;
+        bool first_use {false};
+        {
+            std::lock_guard lock{cache_mutex};
+            auto &slot {cache[item_id]};
+            if (!slot) {
+                slot = std::make_shared<entry_t>();
+                first_use = true;
+            }
+            entry = slot;
+        }
+        if constexpr (traits_t::persistent) {
+            if (first_use) {
+                if (auto snapshot = snapshot_store::instance().load(snapshot_store::key_for<cached_t>(item_id))) {
                     try {
-                        contents = std::make_shared<cached_item_t>(factory());
+                        entry->value.store(std::make_shared<cached_t>(traits_t::deserialize(snapshot->value)));
+                        entry->updated.store(snapshot->updated);
+                        entry->stale = true;
                     }
-                    catch(std::exception const &ex) {
-                        contents = std::make_shared<cached_item_t>(std::unexpected(ex.what()));
-                        if (on_error) on_error(ex.what());
+                    catch(std::exception const &) {
+                        // an unreadable snapshot is just a cold start
+                    }
+                }
+            }
+        }
+
+        auto reload = [&factory, &entry, item_id, on_error](view_executor::priority priority) {
+            entry->requested = std::chrono::system_clock::now();
+            entry->stale = false;
+            entry->loading = true;
+            view_executor::instance().submit({&cache, item_id}, priority, [factory, entry, item_id, on_error] {
+                try {
+                    auto contents {std::make_shared<cached_t>(factory())};
+                    auto const now {std::chrono::system_clock::now()};
+                    if constexpr (traits_t::persistent) {
+                        snapshot_store::instance().save(snapshot_store::key_for<cached_t>(item_id), traits_t::serialize(*contents), now);
                     }
-                    cache[item_id].first.store(contents);
-                }).detach();
+                    entry->value.store(contents);
+                    entry->updated.store(now);
+                    entry->error.store(nullptr);
+                }
+                catch(std::exception const &ex) {
+                    entry->error.store(std::make_shared<std::string const>(ex.what()));
+                    if (on_error) on_error(ex.what());
+                }
+                entry->loading = false;
+            });
         };
 
+        auto &scheduler {refresh_scheduler::instance()};
+        bool const open {no_title || ImGui::CollapsingHeader(name.c_str())};
+        // a header scrolled out of the window is open but not seen
+        if (open && (no_title || ImGui::IsItemVisible())) {
+            scheduler.seen(item_id);
+        }
         if (autorefresh_seconds.has_value()) {
-            auto const now = std::chrono::system_clock::now();
-            if (!cache.contains(item_id) || cache[item_id].second + autorefresh_seconds.value() < now) {
-                reload();
+            if (first_use || scheduler.due(item_id, entry->requested, autorefresh_seconds.value())) {
+                reload(scheduler.recently_seen(item_id) ? view_executor::priority::visible : view_executor::priority::background);
             }
         }
 
-        if (no_title || ImGui::CollapsingHeader(name.c_str())) {
-            envelope_t &cached_copy{cache[item_id]};
-            ptr_t item_ptr = cached_copy.first.load();
+        if (open) {
             ImGui::PushID(item_id);
-            if (item_ptr == nullptr) {
-                reload();
+            auto const value {entry->value.load()};
+            auto const error {entry->error.load()};
+            if (!entry->loading && ((value == nullptr && error == nullptr) || entry->stale)) {
+                reload(view_executor::priority::interactive);
+            }
+            if (error) {
+                constexpr ImVec4 red {ImVec4(1.0f, 0.0f, 0.0f, 1.0f)};
+                ImGui::TextColored(red, ICON_MD_ERROR " %s", error->c_str());
+            }
+            if (value) {
+                renderer(*value);
             }
-            else {
-                if (item_ptr->has_value()) {
-                    renderer(item_ptr->value());
+            else if (entry->loading) {
+                ImGui::TextUnformatted(ICON_MD_DOWNLOADING);
+            }
+            if (value || error) {
+                if (ImGui::SmallButton(ICON_MD_REFRESH)) {
+                    reload(view_executor::priority::interactive);
                 }
-                else {
-                    auto const err{item_ptr->error()};
-                    if (err == "Loading...") {
-                        ImGui::TextUnformatted(ICON_MD_DOWNLOADING);
+                if (value) {
+                    ImGui::SameLine();
+                    auto const age {format_age(std::chrono::system_clock::now() - entry->updated.load())};
+                    if (entry->loading) {
+                        ImGui::TextDisabled(ICON_MD_DOWNLOADING " %s", age.c_str());
                     }
                     else {
-                        constexpr ImVec4 red {ImVec4(1.0f, 0.0f, 0.0f, 1.0f)};
-                        ImGui::TextColored(red, ICON_MD_ERROR " %s", err.c_str());
+                        ImGui::TextDisabled("%s", age.c_str());
                     }
                 }
-                if (ImGui::SmallButton(ICON_MD_REFRESH)) {
-                    cache.erase(item_id);
-                }
             }
             ImGui::PopID();
         }
     }
-}
\ No newline at end of file
+}
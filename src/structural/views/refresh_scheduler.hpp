@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <imgui.h>
+#include <nlohmann/json.hpp>
+
+namespace views {
+    // How auto-refreshing views behave while nobody is looking at them.
+    struct refresh_policy {
+        bool suspend{false};
+        double slowdown{4.0};
+        std::optional<std::chrono::seconds> interval;
+        int visible_frames{30};
+
+        // "background-refresh" in a panel (or group): "suspend", "normal", a number of
+        // seconds, or {"suspend": bool, "slowdown": 4, "seconds": 600, "visible-frames": 30}
+        static refresh_policy from_json(nlohmann::json const &node) {
+            refresh_policy result;
+            if (node.is_string()) {
+                auto const mode = node.get<std::string>();
+                result.suspend = mode == "suspend";
+                if (mode == "normal") {
+                    result.slowdown = 1.0;
+                }
+            }
+            else if (node.is_boolean()) {
+                result.suspend = !node.get<bool>();
+            }
+            else if (node.is_number()) {
+                result.interval = std::chrono::seconds{node.get<int>()};
+            }
+            else if (node.is_object()) {
+                if (node.contains("suspend")) result.suspend = node.at("suspend").get<bool>();
+                if (node.contains("slowdown")) result.slowdown = node.at("slowdown").get<double>();
+                if (node.contains("seconds")) result.interval = std::chrono::seconds{node.at("seconds").get<int>()};
+                if (node.contains("visible-frames")) result.visible_frames = node.at("visible-frames").get<int>();
+            }
+            return result;
+        }
+    };
+
+    // Remembers the last frame each refreshing view was on screen, so hidden ones can be
+    // slowed down or suspended. Panels push their policy around their contents, the way
+    // ImGui pushes ids and styles. UI thread only.
+    struct refresh_scheduler {
+        using duration_t = std::chrono::system_clock::duration;
+
+        static refresh_scheduler &instance() {
+            static refresh_scheduler scheduler;
+            return scheduler;
+        }
+
+        void push_policy(refresh_policy policy) {
+            policies_.push_back(policy);
+        }
+
+        void pop_policy() {
+            policies_.pop_back();
+        }
+
+        refresh_policy const &policy() const {
+            static refresh_policy const default_policy;
+            return policies_.empty() ? default_policy : policies_.back();
+        }
+
+        void seen(ImGuiID id) {
+            last_seen_[id] = ImGui::GetFrameCount();
+        }
+
+        bool recently_seen(ImGuiID id) const {
+            auto const it = last_seen_.find(id);
+            return it != last_seen_.end() && ImGui::GetFrameCount() - it->second <= policy().visible_frames;
+        }
+
+        // the interval that applies to id right now, nothing while suspended
+        std::optional<duration_t> interval(ImGuiID id, duration_t base) const {
+            if (recently_seen(id)) {
+                return base;
+            }
+            auto const &current = policy();
+            if (current.suspend) {
+                return std::nullopt;
+            }
+            if (current.interval) {
+                return std::max<duration_t>(base, *current.interval);
+            }
+            return std::chrono::duration_cast<duration_t>(base * current.slowdown);
+        }
+
+        bool due(ImGuiID id, std::chrono::system_clock::time_point last, duration_t base) const {
+            auto const effective = interval(id, base);
+            return effective && last + *effective < std::chrono::system_clock::now();
+        }
+
+    private:
+        std::vector<refresh_policy> policies_;
+        std::unordered_map<ImGuiID, int> last_seen_;
+    };
+
+    // RAII helper for push_policy/pop_policy
+    struct scoped_refresh_policy {
+        scoped_refresh_policy(std::optional<refresh_policy> const &policy) : active_{policy.has_value()} {
+            if (active_) refresh_scheduler::instance().push_policy(*policy);
+        }
+        ~scoped_refresh_policy() {
+            if (active_) refresh_scheduler::instance().pop_policy();
+        }
+    private:
+        bool active_;
+    };
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <nlohmann/json.hpp>
+
+#include "../../hosting/db/database.hpp"
+
+namespace views {
+    // Which cached_view contents survive a restart; only types that round-trip through
+    // text are persisted, everything else starts empty as before.
+    template<typename T>
+    struct snapshot_traits {
+        static constexpr bool persistent {false};
+    };
+
+    template<>
+    struct snapshot_traits<std::string> {
+        static constexpr bool persistent {true};
+        static constexpr std::string_view kind {"string"};
+        static std::string serialize(std::string const &value) { return value; }
+        static std::string deserialize(std::string const &text) { return text; }
+    };
+
+    template<>
+    struct snapshot_traits<nlohmann::json> {
+        static constexpr bool persistent {true};
+        static constexpr std::string_view kind {"json"};
+        static std::string serialize(nlohmann::json const &value) { return value.dump(); }
+        static nlohmann::json deserialize(std::string const &text) { return nlohmann::json::parse(text); }
+    };
+
+    template<>
+    struct snapshot_traits<nlohmann::json::array_t> {
+        static constexpr bool persistent {true};
+        static constexpr std::string_view kind {"json-array"};
+        static std::string serialize(nlohmann::json::array_t const &value) { return nlohmann::json(value).dump(); }
+        static nlohmann::json::array_t deserialize(std::string const &text) { return nlohmann::json::parse(text).get<nlohmann::json::array_t>(); }
+    };
+
+    template<>
+    struct snapshot_traits<nlohmann::json::object_t> {
+        static constexpr bool persistent {true};
+        static constexpr std::string_view kind {"json-object"};
+        static std::string serialize(nlohmann::json::object_t const &value) { return nlohmann::json(value).dump(); }
+        static nlohmann::json::object_t deserialize(std::string const &text) { return nlohmann::json::parse(text).get<nlohmann::json::object_t>(); }
+    };
+
+    // Last successful result of every persistent view, kept in views.db.
+    struct snapshot_store {
+        struct snapshot_t {
+            std::string value;
+            std::chrono::system_clock::time_point updated;
+        };
+
+        static snapshot_store &instance() {
+            static snapshot_store store{"views.db"};
+            return store;
+        }
+
+        std::optional<snapshot_t> load(std::string const &key) {
+            try {
+                return db_.read([&key](hosting::db::sqlite &db) -> std::optional<snapshot_t> {
+                    for (auto const &[value, updated] : db.query<std::string, long long>("SELECT value, updated FROM snapshots WHERE id = ?", key)) {
+                        return snapshot_t{value, std::chrono::system_clock::time_point{std::chrono::seconds{updated}}};
+                    }
+                    return std::nullopt;
+                });
+            }
+            catch (std::exception const &ex) {
+                std::cerr << "Could not load view snapshot " << key << ": " << ex.what() << std::endl;
+            }
+            return std::nullopt;
+        }
+
+        // queued to the writer thread, the caller goes on
+        void save(std::string const &key, std::string const &value, std::chrono::system_clock::time_point updated) {
+            long long const seconds {std::chrono::duration_cast<std::chrono::seconds>(updated.time_since_epoch()).count()};
+            db_.post([key, value, seconds](hosting::db::sqlite &db) {
+                db.exec("INSERT OR REPLACE INTO snapshots (id, value, updated) VALUES (?, ?, ?)", {}, key, value, seconds);
+            });
+        }
+
+        template<typename T>
+        static std::string key_for(unsigned int item_id) {
+            return std::format("{}:{}", snapshot_traits<T>::kind, item_id);
+        }
+
+    private:
+        snapshot_store(std::string const &path) : db_{path} {
+            db_.write([](hosting::db::sqlite &db) {
+                db.ensure_table("snapshots", "id TEXT PRIMARY KEY, value TEXT, updated INTEGER");
+            }).get();
+        }
+
+        hosting::db::database db_;
+    };
+}
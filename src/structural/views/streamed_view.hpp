@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <imgui.h>
+
+#pragma execution_character_set(push, "utf-8")
+#include "../../../external/IconsMaterialDesign.h"
+#include "cached_view.hpp"
+#include "refresh_scheduler.hpp"
+#include "snapshot_store.hpp"
+#include "view_executor.hpp"
+
+namespace views {
+    using chunk_sink_t = std::function<bool(std::string_view)>;
+    using stream_producer_t = std::function<void(chunk_sink_t const &)>;
+
+    // Output of one run of a command as received so far; the producer appends to it on a
+    // view_executor worker while the UI renders it, so long outputs show up progressively.
+    struct stream_state_t {
+        std::mutex mutex;
+        std::string text;
+        std::optional<std::string> error;
+        std::atomic<bool> running{true};
+        std::atomic<bool> cancelled{false};
+    };
+
+    // Renders text produced by a streaming command, with a stop button while it runs.
+    // Only the last max_bytes are kept, which suits logs where the tail matters most.
+    // Until a new run brings its first chunk (or when it fails) the last complete output
+    // stays on screen with its age; that output is also restored from disk on startup.
+    void streamed_view(
+        std::string const &name, stream_producer_t const &producer,
+        bool no_title = false,
+        std::optional<std::chrono::system_clock::duration> autorefresh_seconds = std::nullopt,
+        size_t max_bytes = 4 * 1024 * 1024)
+    {
+        // runs hold on to their entry, the map itself is only touched from the UI thread
+        struct entry_t {
+            std::atomic<std::shared_ptr<stream_state_t>> run;
+            std::atomic<std::shared_ptr<std::string const>> last;
+            std::atomic<std::chrono::system_clock::time_point> updated;
+            std::chrono::system_clock::time_point requested;
+        };
+        static std::unordered_map<ImGuiID, std::shared_ptr<entry_t>> streams;
+
+        auto const item_id {ImGui::GetID(name.c_str())};
+        // not key_for<std::string>: a cached_view of the same name keeps its own snapshot
+        auto const snapshot_key {std::format("stream:{}", item_id)};
+        auto &entry {streams[item_id]};
+        bool const first_use {!entry};
+        if (first_use) {
+            entry = std::make_shared<entry_t>();
+            if (auto snapshot = snapshot_store::instance().load(snapshot_key)) {
+                entry->last.store(std::make_shared<std::string const>(std::move(snapshot->value)));
+                entry->updated.store(snapshot->updated);
+            }
+        }
+
+        auto start = [&producer, &entry, &snapshot_key, item_id, max_bytes](view_executor::priority priority) {
+            entry->requested = std::chrono::system_clock::now();
+            auto state = std::make_shared<stream_state_t>();
+            // a run already queued or streaming for this view is left to finish
+            if (!view_executor::instance().submit({&streams, item_id}, priority,
+                [producer, state, entry = entry, snapshot_key, max_bytes] {
+                    try {
+                        producer([&state, max_bytes](std::string_view chunk) {
+                            if (state->cancelled) {
+                                return false;
+                            }
+                            std::lock_guard lock{state->mutex};
+                            state->text.append(chunk);
+                            if (state->text.size() > max_bytes) {
+                                state->text.erase(0, state->text.size() - max_bytes);
+                            }
+                            return true;
+                        });
+                    }
+                    catch(std::exception const &ex) {
+                        std::lock_guard lock{state->mutex};
+                        state->error = ex.what();
+                    }
+                    if (!state->cancelled && !state->error) {
+                        std::shared_ptr<std::string const> text;
+                        {
+                            std::lock_guard lock{state->mutex};
+                            text = std::make_shared<std::string const>(state->text);
+                        }
+                        auto const now {std::chrono::system_clock::now()};
+                        snapshot_store::instance().save(snapshot_key, *text, now);
+                        entry->last.store(text);
+                        entry->updated.store(now);
+                    }
+                    state->running = false;
+                })) {
+                return;
+            }
+            entry->run.store(state);
+        };
+
+        auto &scheduler {refresh_scheduler::instance()};
+        bool const open {no_title || ImGui::CollapsingHeader(name.c_str())};
+        // a header scrolled out of the window is open but not seen
+        if (open && (no_title || ImGui::IsItemVisible())) {
+            scheduler.seen(item_id);
+        }
+        auto run {entry->run.load()};
+        if (autorefresh_seconds.has_value()) {
+            if (first_use || ((!run || !run->running) && scheduler.due(item_id, entry->requested, autorefresh_seconds.value()))) {
+                start(scheduler.recently_seen(item_id) ? view_executor::priority::visible : view_executor::priority::background);
+                run = entry->run.load();
+            }
+        }
+
+        if (open) {
+            ImGui::PushID(item_id);
+            if (!run) {
+                start(view_executor::priority::interactive);
+                run = entry->run.load();
+            }
+            bool const running {run && run->running};
+            if (running) {
+                ImGui::TextUnformatted(ICON_MD_DOWNLOADING);
+                ImGui::SameLine();
+                if (ImGui::SmallButton(ICON_MD_STOP)) {
+                    run->cancelled = true;
+                }
+            }
+            else if (ImGui::SmallButton(ICON_MD_REFRESH)) {
+                start(view_executor::priority::interactive);
+            }
+            auto const last {entry->last.load()};
+            std::unique_lock<std::mutex> lock;
+            if (run) {
+                lock = std::unique_lock{run->mutex};
+                if (run->error) {
+                    constexpr ImVec4 red {ImVec4(1.0f, 0.0f, 0.0f, 1.0f)};
+                    ImGui::TextColored(red, ICON_MD_ERROR " %s", run->error->c_str());
+                }
+            }
+            // what this run brought so far, unless it has nothing better than the last output
+            bool const partial {run && (running || run->cancelled) && !run->text.empty()};
+            std::string_view text;
+            if (!partial && last) {
+                text = *last;
+                ImGui::SameLine();
+                ImGui::TextDisabled("%s", format_age(std::chrono::system_clock::now() - entry->updated.load()).c_str());
+            }
+            else if (run) {
+                text = run->text;
+            }
+            ImGui::PushTextWrapPos(0.0f);
+            ImGui::TextUnformatted(text.data(), text.data() + text.size());
+            ImGui::PopTextWrapPos();
+            ImGui::PopID();
+        }
+    }
+}
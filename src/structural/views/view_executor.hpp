@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+namespace views {
+    // Runs view reloads on a small set of shared threads instead of one detached thread
+    // per reload. Jobs are keyed, so asking again for something queued or running is a
+    // no-op (at most it raises the priority of the queued job), and visible or clicked
+    // items are picked before background refreshes.
+    struct view_executor {
+        enum class priority { background, visible, interactive };
+
+        struct key_t {
+            void const *domain;
+            std::uint64_t id;
+            bool operator==(key_t const &) const = default;
+        };
+
+        struct options_t {
+            size_t workers{8};
+
+            // reads the "views" section of beatograph.json, e.g. {"workers": 8}
+            static options_t from_json(nlohmann::json const &node) {
+                options_t result;
+                if (node.contains("workers")) {
+                    result.workers = node.at("workers").get<size_t>();
+                }
+                return result;
+            }
+        };
+
+        static view_executor &instance() {
+            // never destroyed: workers may still be blocked in a reload at exit
+            static auto executor = new view_executor;
+            return *executor;
+        }
+
+        void configure(options_t options) {
+            std::lock_guard lock{mutex_};
+            max_workers_ = std::max<size_t>(1, options.workers);
+            cv_.notify_all();
+        }
+
+        // returns false when the same key was already queued or running
+        bool submit(key_t key, priority prio, std::function<void()> task) {
+            std::lock_guard lock{mutex_};
+            if (auto it = jobs_.find(key); it != jobs_.end()) {
+                auto &job = it->second;
+                if (!job.running && prio > job.prio) {
+                    queue_.erase({-static_cast<int>(job.prio), job.seq});
+                    job.prio = prio;
+                    queue_.emplace(std::make_pair(-static_cast<int>(prio), job.seq), key);
+                }
+                return false;
+            }
+            auto const seq = next_seq_++;
+            jobs_.emplace(key, job_t{std::move(task), prio, seq, false});
+            queue_.emplace(std::make_pair(-static_cast<int>(prio), seq), key);
+            if (idle_workers_ == 0 && workers_ < max_workers_) {
+                ++workers_;
+                std::thread([this] { work(); }).detach();
+            }
+            else {
+                cv_.notify_one();
+            }
+            return true;
+        }
+
+        bool pending(key_t key) const {
+            std::lock_guard lock{mutex_};
+            return jobs_.contains(key);
+        }
+
+    private:
+        struct key_hash {
+            size_t operator()(key_t const &key) const {
+                return std::hash<void const *>{}(key.domain) ^ (std::hash<std::uint64_t>{}(key.id) * 31);
+            }
+        };
+
+        struct job_t {
+            std::function<void()> task;
+            priority prio;
+            std::uint64_t seq;
+            bool running;
+        };
+
+        view_executor() = default;
+
+        void work() {
+            std::unique_lock lock{mutex_};
+            for (;;) {
+                ++idle_workers_;
+                cv_.wait(lock, [this] { return !queue_.empty() || workers_ > max_workers_; });
+                --idle_workers_;
+                if (workers_ > max_workers_) {
+                    --workers_;
+                    return;
+                }
+                auto const key = queue_.begin()->second;
+                queue_.erase(queue_.begin());
+                auto &job = jobs_.at(key);
+                job.running = true;
+                auto task = std::move(job.task);
+                lock.unlock();
+                try {
+                    task();
+                }
+                catch (std::exception const &ex) {
+                    std::cerr << "view reload failed: " << ex.what() << std::endl;
+                }
+                lock.lock();
+                jobs_.erase(key);
+            }
+        }
+
+        mutable std::mutex mutex_;
+        std::condition_variable cv_;
+        // (-priority, submission order) -> key, so the first entry is the next to run
+        std::map<std::pair<int, std::uint64_t>, key_t> queue_;
+        std::unordered_map<key_t, job_t, key_hash> jobs_;
+        std::uint64_t next_seq_{0};
+        size_t max_workers_{8};
+        size_t workers_{0};
+        size_t idle_workers_{0};
+    };
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace hashing
+{
+    // Incremental SHA-256 (FIPS 180-4); the digest is stable across compilers
+    // and platforms, unlike std::hash, so it can be used for on-disk keys.
+    struct sha256
+    {
+        sha256() { reset(); }
+
+        void reset()
+        {
+            state_ = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+            length_ = 0;
+            buffered_ = 0;
+        }
+
+        void update(void const *data, size_t size)
+        {
+            auto bytes = static_cast<unsigned char const *>(data);
+            length_ += size;
+            while (size > 0)
+            {
+                auto const take = std::min(size, block_.size() - buffered_);
+                std::copy(bytes, bytes + take, block_.begin() + buffered_);
+                buffered_ += take;
+                bytes += take;
+                size -= take;
+                if (buffered_ == block_.size())
+                {
+                    transform();
+                    buffered_ = 0;
+                }
+            }
+        }
+
+        void update(std::string_view data)
+        {
+            update(data.data(), data.size());
+        }
+
+        std::array<unsigned char, 32> digest()
+        {
+            uint64_t const bit_length{length_ * 8};
+            unsigned char const pad_start{0x80};
+            update(&pad_start, 1);
+            unsigned char const zero{0};
+            while (buffered_ != 56)
+            {
+                update(&zero, 1);
+            }
+            unsigned char length_bytes[8];
+            for (int i = 0; i < 8; ++i)
+            {
+                length_bytes[i] = static_cast<unsigned char>(bit_length >> (56 - 8 * i));
+            }
+            update(length_bytes, sizeof(length_bytes));
+            std::array<unsigned char, 32> result;
+            for (size_t i = 0; i < state_.size(); ++i)
+            {
+                result[i * 4] = static_cast<unsigned char>(state_[i] >> 24);
+                result[i * 4 + 1] = static_cast<unsigned char>(state_[i] >> 16);
+                result[i * 4 + 2] = static_cast<unsigned char>(state_[i] >> 8);
+                result[i * 4 + 3] = static_cast<unsigned char>(state_[i]);
+            }
+            reset();
+            return result;
+        }
+
+        std::string hex_digest()
+        {
+            static constexpr std::string_view hex_chars{"0123456789abcdef"};
+            std::string result;
+            result.reserve(64);
+            for (auto const b : digest())
+            {
+                result += hex_chars[b >> 4];
+                result += hex_chars[b & 0x0f];
+            }
+            return result;
+        }
+
+        static std::string hex(std::string_view data)
+        {
+            sha256 h;
+            h.update(data);
+            return h.hex_digest();
+        }
+
+    private:
+        static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+        void transform()
+        {
+            static constexpr std::array<uint32_t, 64> k{
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+            uint32_t w[64];
+            for (int i = 0; i < 16; ++i)
+            {
+                w[i] = (static_cast<uint32_t>(block_[i * 4]) << 24) |
+                       (static_cast<uint32_t>(block_[i * 4 + 1]) << 16) |
+                       (static_cast<uint32_t>(block_[i * 4 + 2]) << 8) |
+                       static_cast<uint32_t>(block_[i * 4 + 3]);
+            }
+            for (int i = 16; i < 64; ++i)
+            {
+                auto const s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                auto const s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            auto a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+            auto e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+            for (int i = 0; i < 64; ++i)
+            {
+                auto const s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+                auto const ch = (e & f) ^ (~e & g);
+                auto const t1 = h + s1 + ch + k[i] + w[i];
+                auto const s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+                auto const maj = (a & b) ^ (a & c) ^ (b & c);
+                auto const t2 = s0 + maj;
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state_[0] += a;
+            state_[1] += b;
+            state_[2] += c;
+            state_[3] += d;
+            state_[4] += e;
+            state_[5] += f;
+            state_[6] += g;
+            state_[7] += h;
+        }
+
+        std::array<uint32_t, 8> state_;
+        std::array<unsigned char, 64> block_;
+        uint64_t length_;
+        size_t buffered_;
+    };
+}